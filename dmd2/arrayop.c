@@ -401,6 +401,14 @@ Expression *BinExp::arrayOp(Scope *sc)
              */
             fd = FuncDeclaration::genCfunc(type, ident);
         }
+#endif
+        /* The semantic passes above may have added to the table,
+         * which invalidates pfd.
+         */
+#if IN_LLVM
+        pfd = (FuncDeclaration **)_aaGet(&sc->module->arrayfuncs, ident);
+#else
+        pfd = (FuncDeclaration **)_aaGet(&arrayfuncs, ident);
 #endif
         *pfd = fd;      // cache symbol in hash table
     }
@@ -779,6 +779,22 @@ const char *OverloadSet::kind()
 
 /********************************* ScopeDsymbol ****************************/
 
+unsigned ScopeDsymbol::searchGeneration;
+unsigned ScopeDsymbol::searchDepth;
+unsigned ScopeDsymbol::searchCacheLookups;
+unsigned ScopeDsymbol::searchCacheHits;
+
+/* A cached result of searchImports(), valid while searchGeneration
+ * does not change.
+ */
+struct SearchCacheEntry
+{
+    SearchCacheEntry *next;     // entries for other flags
+    Dsymbol *s;
+    unsigned generation;
+    int flags;
+};
+
 ScopeDsymbol::ScopeDsymbol()
     : Dsymbol()
 {
@@ -786,6 +802,8 @@ ScopeDsymbol::ScopeDsymbol()
     symtab = NULL;
     imports = NULL;
     prots = NULL;
+    searchCache = NULL;
+    importedScope = 0;
 }
 
 ScopeDsymbol::ScopeDsymbol(Identifier *id)
@@ -795,6 +813,8 @@ ScopeDsymbol::ScopeDsymbol(Identifier *id)
     symtab = NULL;
     imports = NULL;
     prots = NULL;
+    searchCache = NULL;
+    importedScope = 0;
 }
 
 Dsymbol *ScopeDsymbol::syntaxCopy(Dsymbol *s)
@@ -831,6 +851,58 @@ Dsymbol *ScopeDsymbol::search(Loc loc, Identifier *ident, int flags)
         //printf("\ts = '%s.%s'\n",toChars(),s->toChars());
     }
     else if (imports)
+    {
+        /* Only results of outermost searches are cached: nested ones see
+         * modules that are already being searched as empty.
+         */
+        if (searchDepth)
+            return searchImports(loc, ident, flags);
+
+        searchCacheLookups++;
+        SearchCacheEntry **pe = (SearchCacheEntry **)_aaGet(&searchCache, (Key)ident);
+        SearchCacheEntry *e;
+        for (e = *pe; e; e = e->next)
+        {
+            if (e->flags == flags)
+                break;
+        }
+        if (e && e->generation == searchGeneration)
+        {
+            searchCacheHits++;
+            return e->s;
+        }
+
+        unsigned generation = searchGeneration;
+        unsigned errors = global.errors;
+        s = searchImports(loc, ident, flags);
+
+        // Don't cache if the search changed what it depends on or if it
+        // diagnosed something, a cache hit would lose the error.
+        if (generation == searchGeneration && errors == global.errors)
+        {
+            if (!e)
+            {   // pe is stale if the search added to searchCache
+                pe = (SearchCacheEntry **)_aaGet(&searchCache, (Key)ident);
+                e = new SearchCacheEntry();
+                e->flags = flags;
+                e->next = *pe;
+                *pe = e;
+            }
+            e->s = s;
+            e->generation = generation;
+        }
+    }
+    return s;
+}
+
+/*****************************************
+ * Search the imports of this scope for ident.
+ */
+
+Dsymbol *ScopeDsymbol::searchImports(Loc loc, Identifier *ident, int flags)
+{
+    Dsymbol *s = NULL;
+    searchDepth++;
     {
         OverloadSet *a = NULL;
 
@@ -900,7 +972,10 @@ Dsymbol *ScopeDsymbol::search(Loc loc, Identifier *ident, int flags)
                             continue;
                         }
                         if (flags & 4)          // if return NULL on ambiguity
-                            return NULL;
+                        {   s = NULL;
+                            a = NULL;
+                            break;
+                        }
                         if (!(flags & 2))
                             ScopeDsymbol::multiplyDefined(loc, s, s2);
                         break;
@@ -926,6 +1001,7 @@ Dsymbol *ScopeDsymbol::search(Loc loc, Identifier *ident, int flags)
                 error(loc, "%s is private", d->toPrettyChars());
         }
     }
+    searchDepth--;
     return s;
 }
 
@@ -953,7 +1029,12 @@ void ScopeDsymbol::importScope(Dsymbol *s, enum PROT protection)
         imports->push(s);
         prots = (unsigned char *)mem.realloc(prots, imports->dim * sizeof(prots[0]));
         prots[imports->dim - 1] = protection;
+
+        ScopeDsymbol *sds = s->isScopeDsymbol();
+        if (sds)
+            sds->importedScope = 1;
     }
+    searchGeneration++;
 }
 
 int ScopeDsymbol::isforwardRef()
@@ -1022,6 +1103,9 @@ const char *ScopeDsymbol::kind()
 
 Dsymbol *ScopeDsymbol::symtabInsert(Dsymbol *s)
 {
+    // the new member may be found through the imports of other scopes
+    if (importedScope)
+        searchGeneration++;
     return symtab->insert(s);
 }
 
@@ -294,10 +294,19 @@ struct ScopeDsymbol : Dsymbol
     Dsymbols *imports;          // imported Dsymbol's
     unsigned char *prots;       // array of PROT, one for each import
 
+    AA *searchCache;            // results of searching the imports, by Identifier
+    unsigned char importedScope; // some scope has this one in its imports[]
+
+    static unsigned searchGeneration;   // bumped whenever a search of imports may change
+    static unsigned searchDepth;        // nesting of searchImports()
+    static unsigned searchCacheLookups;
+    static unsigned searchCacheHits;
+
     ScopeDsymbol();
     ScopeDsymbol(Identifier *id);
     Dsymbol *syntaxCopy(Dsymbol *s);
     Dsymbol *search(Loc loc, Identifier *ident, int flags);
+    Dsymbol *searchImports(Loc loc, Identifier *ident, int flags);
     void importScope(Dsymbol *s, enum PROT protection);
     int isforwardRef();
     void defineRef(Dsymbol *s);
@@ -48,21 +48,47 @@ const char* Pprotectionnames[] = {NULL, "none", "private", "package", "protected
 
 void JsonRemoveComma(OutBuffer *buf);
 
-void json_generate(Modules *modules)
+/*********************************
+ * Write the modules as a JSON array to f, rendering one module at a time
+ * so the whole document never has to be kept in memory.
+ */
+static void json_stream(Modules *modules, FILE *f)
 {   OutBuffer buf;
 
-    buf.writestring("[\n");
+    fputs("[\n", f);
     for (size_t i = 0; i < modules->dim; i++)
     {   Module *m = modules->tdata()[i];
         if (global.params.verbose)
             printf("json gen %s\n", m->toChars());
+        buf.reset();
+        if (i)
+            buf.writestring(",\n");
         m->toJsonBuffer(&buf);
-        buf.writestring(",\n");
+        fwrite(buf.data, 1, buf.offset, f);
+    }
+    fputs("]\n", f);
+}
+
+static void json_stream(Modules *modules, const char *filename)
+{
+    char *pt = FileName::path(filename);
+    if (*pt)
+        FileName::ensurePathExists(pt);
+    mem.free(pt);
+
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {   error("Error writing file '%s'\n", filename);
+        return;
     }
-    JsonRemoveComma(&buf);
-    buf.writestring("]\n");
+    json_stream(modules, f);
+    int failed = ferror(f);
+    if (fclose(f) || failed)
+        error("Error writing file '%s'\n", filename);
+}
 
-    // Write buf to file
+void json_generate(Modules *modules)
+{
     char *arg = global.params.xfilename;
     if (!arg || !*arg)
     {   // Generate lib file name from first obj name
@@ -74,24 +100,28 @@ void json_generate(Modules *modules)
     }
     else if (arg[0] == '-' && arg[1] == 0)
     {   // Write to stdout; assume it succeeds
-        int n = fwrite(buf.data, 1, buf.offset, stdout);
-        assert(n == buf.offset);        // keep gcc happy about return values
+        json_stream(modules, stdout);
         return;
     }
 //    if (!FileName::absolute(arg))
 //        arg = FileName::combine(dir, arg);
     FileName *jsonfilename = FileName::defaultExt(arg, global.json_ext);
-    File *jsonfile = new File(jsonfilename);
-    assert(jsonfile);
-    jsonfile->setbuffer(buf.data, buf.offset);
-    jsonfile->ref = 1;
-    char *pt = FileName::path(jsonfile->toChars());
-    if (*pt)
-        FileName::ensurePathExists(pt);
-    mem.free(pt);
-    jsonfile->writev();
+    json_stream(modules, jsonfilename->toChars());
 }
 
+#if IN_LLVM
+/*********************************
+ * Write the JSON file for a single module, in the same form
+ * json_generate(Modules *) uses.
+ */
+void json_generate(Module *m, const char *filename)
+{   Modules modules;
+
+    modules.push(m);
+    json_stream(&modules, filename);
+}
+#endif
+
 
 /*********************************
  * Encode string into buf, and wrap it in double quotes.
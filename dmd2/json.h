@@ -19,6 +19,10 @@
 #include "arraytypes.h"
 
 void json_generate(Modules *);
+#if IN_LLVM
+struct Module;
+void json_generate(Module *m, const char *filename);
+#endif
 
 #endif /* DMD_JSON_H */
 
@@ -76,6 +76,90 @@ static void cmtable_init()
 }
 
 
+/********************************************
+ * Scanning kernels for the loops over whitespace, comments and strings.
+ * They look at 16 bytes at a time and stop at the first byte the
+ * byte-at-a-time loop has to deal with, or shortly before end, counting
+ * the '\n's skipped over. Without SSE2 they skip nothing.
+ */
+
+#if __SSE2__ && __GNUC__
+#include <emmintrin.h>
+
+/* Skip anything but c1, c2, '\r', 0, 0x1A and non-ASCII bytes.
+ */
+static unsigned char *skipPlain(unsigned char *p, unsigned char *end,
+        unsigned char c1, unsigned char c2, unsigned *linnum)
+{
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    const __m128i vcr = _mm_set1_epi8('\r');
+    const __m128i vnl = _mm_set1_epi8('\n');
+    const __m128i veof = _mm_set1_epi8(0x1A);
+    const __m128i vzero = _mm_setzero_si128();
+
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i stop = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, vcr),
+                _mm_or_si128(_mm_cmpeq_epi8(v, vzero), _mm_cmpeq_epi8(v, veof))));
+        // the sign bit of v flags the non-ASCII bytes
+        unsigned stopmask = _mm_movemask_epi8(stop) | _mm_movemask_epi8(v);
+        unsigned nlmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vnl));
+        if (stopmask)
+        {   unsigned i = __builtin_ctz(stopmask);
+            *linnum += __builtin_popcount(nlmask & ((1u << i) - 1));
+            return p + i;
+        }
+        *linnum += __builtin_popcount(nlmask);
+        p += 16;
+    }
+    return p;
+}
+
+/* Skip spaces, tabs and '\n's.
+ */
+static unsigned char *skipBlanks(unsigned char *p, unsigned char *end, unsigned *linnum)
+{
+    const __m128i vsp = _mm_set1_epi8(' ');
+    const __m128i vtab = _mm_set1_epi8('\t');
+    const __m128i vnl = _mm_set1_epi8('\n');
+
+    while (p + 16 <= end)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned blankmask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, vsp), _mm_cmpeq_epi8(v, vtab)));
+        unsigned nlmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vnl));
+        unsigned stopmask = ~(blankmask | nlmask) & 0xFFFF;
+        if (stopmask)
+        {   unsigned i = __builtin_ctz(stopmask);
+            *linnum += __builtin_popcount(nlmask & ((1u << i) - 1));
+            return p + i;
+        }
+        *linnum += __builtin_popcount(nlmask);
+        p += 16;
+    }
+    return p;
+}
+
+#else
+
+inline unsigned char *skipPlain(unsigned char *p, unsigned char *end,
+        unsigned char c1, unsigned char c2, unsigned *linnum)
+{
+    return p;
+}
+
+inline unsigned char *skipBlanks(unsigned char *p, unsigned char *end, unsigned *linnum)
+{
+    return p;
+}
+
+#endif
+
 /************************* Token **********************************************/
 
 const char *Token::tochars[TOKMAX];
@@ -502,6 +586,8 @@ void Lexer::scan(Token *t)
             case '\v':
             case '\f':
                 p++;
+                if (*p == ' ' || *p == '\t' || *p == '\n')
+                    p = skipBlanks(p, end, &loc.linnum);
                 continue;                       // skip white space
 
             case '\r':
@@ -513,6 +599,7 @@ void Lexer::scan(Token *t)
             case '\n':
                 p++;
                 loc.linnum++;
+                p = skipBlanks(p, end, &loc.linnum);    // indentation
                 continue;                       // skip white space
 
             case '0':   case '1':   case '2':   case '3':   case '4':
@@ -773,7 +860,8 @@ void Lexer::scan(Token *t)
                         while (1)
                         {
                             while (1)
-                            {   unsigned char c = *p;
+                            {   p = skipPlain(p, end, '/', '/', &loc.linnum);
+                                unsigned char c = *p;
                                 switch (c)
                                 {
                                     case '/':
@@ -826,7 +914,8 @@ void Lexer::scan(Token *t)
                     case '/':           // do // style comments
                         linnum = loc.linnum;
                         while (1)
-                        {   unsigned char c = *++p;
+                        {   p = skipPlain(p + 1, end, '\n', '\n', &loc.linnum);
+                            unsigned char c = *p;
                             switch (c)
                             {
                                 case '\n':
@@ -883,7 +972,8 @@ void Lexer::scan(Token *t)
                         p++;
                         nest = 1;
                         while (1)
-                        {   unsigned char c = *p;
+                        {   p = skipPlain(p, end, '/', '+', &loc.linnum);
+                            unsigned char c = *p;
                             switch (c)
                             {
                                 case '/':
@@ -1391,6 +1481,9 @@ TOK Lexer::wysiwygStringConstant(Token *t, int tc)
     stringbuffer.reset();
     while (1)
     {
+        unsigned char *q = skipPlain(p, end, tc, tc, &loc.linnum);
+        stringbuffer.write(p, q - p);
+        p = q;
         c = *p++;
         switch (c)
         {
@@ -1758,6 +1851,9 @@ TOK Lexer::escapeStringConstant(Token *t, int wide)
     stringbuffer.reset();
     while (1)
     {
+        unsigned char *q = skipPlain(p, end, '"', '\\', &loc.linnum);
+        stringbuffer.write(p, q - p);
+        p = q;
         c = *p++;
         switch (c)
         {
@@ -195,7 +195,11 @@ void errorSupplemental(Loc loc, const char *format, ...)
 
 void verror(Loc loc, const char *format, va_list ap)
 {
-    if (!global.gag)
+    if (!global.gag
+#if IN_LLVM
+        && !global.mute
+#endif
+       )
     {
         char *p = loc.toChars();
 
@@ -216,7 +220,7 @@ void verror(Loc loc, const char *format, va_list ap)
         fflush(stdmsg);
 //halt();
     }
-    else
+    else if (global.gag)
     {
         global.gaggedErrors++;
     }
@@ -226,7 +230,11 @@ void verror(Loc loc, const char *format, va_list ap)
 // Doesn't increase error count, doesn't print "Error:".
 void verrorSupplemental(Loc loc, const char *format, va_list ap)
 {
-    if (!global.gag)
+    if (!global.gag
+#if IN_LLVM
+        && !global.mute
+#endif
+       )
     {
         fprintf(stdmsg, "%s:        ", loc.toChars());
 #if _MSC_VER
@@ -244,7 +252,11 @@ void verrorSupplemental(Loc loc, const char *format, va_list ap)
 
 void vwarning(Loc loc, const char *format, va_list ap)
 {
-    if (global.params.warnings && !global.gag)
+    if (global.params.warnings && !global.gag
+#if IN_LLVM
+        && !global.mute
+#endif
+       )
     {
         char *p = loc.toChars();
 
@@ -271,6 +271,7 @@ struct Param
     bool useInlineAsm;
     bool verbose_cg;
     bool useAvailableExternally;
+    char *xdir;                 // write a JSON file per module to xdir
 
     // target stuff
     const char* llvmArch;
@@ -315,6 +316,9 @@ struct Global
     unsigned warnings;     // number of warnings reported so far
     unsigned gag;          // !=0 means gag reporting of errors & warnings
     unsigned gaggedErrors; // number of errors reported while gagged
+#if IN_LLVM
+    unsigned mute;         // !=0 means errors & warnings are counted but not printed
+#endif
 
     // Start gagging. Return the current number of gagged errors
     unsigned startGagging();
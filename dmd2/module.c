@@ -217,6 +217,7 @@ Module::Module(char *filename, Identifier *ident, int doDocComment, int doHdrGen
     this->doDocComment = doDocComment;
     this->doHdrGen = doHdrGen;
     this->isRoot = false;
+    this->reportedElsewhere = false;
     this->arrayfuncs = 0;
 #endif
 }
@@ -851,9 +852,16 @@ void Module::importAll(Scope *prevsc)
     if (scope)
         return;                 // already done
 
+#if IN_LLVM
+    unsigned oldmute = global.mute;
+    global.mute = reportedElsewhere;
+#endif
     if (isDocFile)
     {
         error("is a Ddoc file, cannot import it");
+#if IN_LLVM
+        global.mute = oldmute;
+#endif
         return;
     }
 
@@ -905,6 +913,9 @@ void Module::importAll(Scope *prevsc)
 
     sc = sc->pop();
     sc->pop();          // 2 pops because Scope::createGlobal() created 2
+#if IN_LLVM
+    global.mute = oldmute;
+#endif
 }
 
 void Module::semantic(Scope* unused_sc)
@@ -914,6 +925,10 @@ void Module::semantic(Scope* unused_sc)
 
     //printf("+Module::semantic(this = %p, '%s'): parent = %p\n", this, toChars(), parent);
     semanticstarted = 1;
+#if IN_LLVM
+    unsigned oldmute = global.mute;
+    global.mute = reportedElsewhere;
+#endif
 
     // Note that modules get their own scope, from scratch.
     // This is so regardless of where in the syntax a module
@@ -974,6 +989,9 @@ void Module::semantic(Scope* unused_sc)
         sc->pop();              // 2 pops because Scope::createGlobal() created 2
     }
     semanticRun = semanticstarted;
+#if IN_LLVM
+    global.mute = oldmute;
+#endif
     //printf("-Module::semantic(this = %p, '%s'): parent = %p\n", this, toChars(), parent);
 }
 
@@ -981,12 +999,19 @@ void Module::semantic2(Scope* unused_sc)
 {
     if (deferred.dim)
     {
+#if IN_LLVM
+        unsigned oldmute = global.mute;
+        global.mute = reportedElsewhere;
+#endif
         for (size_t i = 0; i < deferred.dim; i++)
         {
             Dsymbol *sd = deferred.tdata()[i];
 
             sd->error("unable to resolve forward reference in definition");
         }
+#if IN_LLVM
+        global.mute = oldmute;
+#endif
         return;
     }
     //printf("Module::semantic2('%s'): parent = %p\n", toChars(), parent);
@@ -994,6 +1019,10 @@ void Module::semantic2(Scope* unused_sc)
         return;
     assert(semanticstarted == 1);
     semanticstarted = 2;
+#if IN_LLVM
+    unsigned oldmute = global.mute;
+    global.mute = reportedElsewhere;
+#endif
 
     // Note that modules get their own scope, from scratch.
     // This is so regardless of where in the syntax a module
@@ -1012,6 +1041,9 @@ void Module::semantic2(Scope* unused_sc)
     sc = sc->pop();
     sc->pop();
     semanticRun = semanticstarted;
+#if IN_LLVM
+    global.mute = oldmute;
+#endif
     //printf("-Module::semantic2('%s'): parent = %p\n", toChars(), parent);
 }
 
@@ -1022,6 +1054,10 @@ void Module::semantic3(Scope* unused_sc)
         return;
     assert(semanticstarted == 2);
     semanticstarted = 3;
+#if IN_LLVM
+    unsigned oldmute = global.mute;
+    global.mute = reportedElsewhere;
+#endif
 
     // Note that modules get their own scope, from scratch.
     // This is so regardless of where in the syntax a module
@@ -1041,6 +1077,9 @@ void Module::semantic3(Scope* unused_sc)
     sc = sc->pop();
     sc->pop();
     semanticRun = semanticstarted;
+#if IN_LLVM
+    global.mute = oldmute;
+#endif
 }
 
 void Module::inlineScan()
@@ -1141,6 +1180,7 @@ Dsymbol *Module::symtabInsert(Dsymbol *s)
 
 void Module::clearCache()
 {
+    ScopeDsymbol::searchGeneration++;
     for (size_t i = 0; i < amodules.dim; i++)
     {   Module *m = amodules.tdata()[i];
         m->searchCacheIdent = NULL;
@@ -214,6 +214,8 @@ struct Module : Package
     AA *arrayfuncs;
 
     bool isRoot;
+    // another -j job compiles this module and reports its errors
+    bool reportedElsewhere;
 #endif
 };
 
@@ -1636,6 +1636,111 @@ void Type::modToBuffer(OutBuffer *buf)
 /************************************
  */
 
+/**************************
+ * Structural hash-consing in front of the deco string tables.
+ * Types whose deco is fully determined by (ty, mod, next, extra) -
+ * basic types, pointers, references, arrays, associative arrays and
+ * delegates - are looked up here first, so forming a type that already
+ * exists builds no deco strings at all. The string tables stay the
+ * authority: an entry is only added after they produced the canonical type.
+ */
+
+struct TypeConsEntry
+{
+    TypeConsEntry *chain;
+    hash_t hash;
+    Type *next;                 // merged next type, or NULL
+    dinteger_t extra;           // static array dimension, or merged AA index type
+    unsigned char ty;
+    unsigned char mod;
+    Type *t;                    // canonical type
+};
+
+static TypeConsEntry **typeConsTable;
+static size_t typeConsDim;
+static size_t typeConsCount;
+
+/* Fills in the key for t, returns 0 if t is not hash-consed. */
+static int typeConsKey(Type *t, TypeConsEntry *key)
+{
+    key->ty = t->ty;
+    key->mod = t->mod;
+    key->next = NULL;
+    key->extra = 0;
+
+    switch (t->ty)
+    {
+        case Tpointer:
+        case Treference:
+        case Tarray:
+        case Tdelegate:
+            break;
+
+        case Tsarray:
+        {   Expression *dim = ((TypeSArray *)t)->dim;
+            if (!dim || dim->op != TOKint64)
+                return 0;
+            key->extra = dim->toInteger();
+            break;
+        }
+
+        case Taarray:
+        {   Type *index = ((TypeAArray *)t)->index->merge();
+            if (!index->deco)
+                return 0;
+            key->extra = (dinteger_t)(size_t)index;
+            break;
+        }
+
+        default:
+            if (!t->isTypeBasic() || t->ty == Terror)
+                return 0;
+            break;
+    }
+
+    if (t->nextOf())
+    {   key->next = t->nextOf()->merge();
+        if (!key->next->deco)
+            return 0;
+    }
+
+    key->hash = ((size_t)key->next >> 3) * 31 + (size_t)key->extra * 17 + key->ty * 5 + key->mod;
+    return 1;
+}
+
+static TypeConsEntry **typeConsFind(TypeConsEntry *key)
+{
+    TypeConsEntry **pe = &typeConsTable[key->hash % typeConsDim];
+    for (; *pe; pe = &(*pe)->chain)
+    {   TypeConsEntry *e = *pe;
+        if (e->hash == key->hash && e->next == key->next && e->extra == key->extra &&
+            e->ty == key->ty && e->mod == key->mod)
+            break;
+    }
+    return pe;
+}
+
+static void typeConsGrow()
+{
+    size_t odim = typeConsDim;
+    TypeConsEntry **otable = typeConsTable;
+
+    typeConsDim = odim ? odim * 4 + 1 : 1021;
+    typeConsTable = (TypeConsEntry **)mem.calloc(typeConsDim, sizeof(TypeConsEntry *));
+    for (size_t i = 0; i < odim; i++)
+    {
+        for (TypeConsEntry *e = otable[i]; e; )
+        {   TypeConsEntry *chain = e->chain;
+            size_t j = e->hash % typeConsDim;
+            e->chain = typeConsTable[j];
+            typeConsTable[j] = e;
+            e = chain;
+        }
+    }
+    if (otable)
+        mem.free(otable);
+}
+
 Type *Type::merge()
 {
     if (ty == Terror) return this;
@@ -1650,6 +1755,17 @@ Type *Type::merge()
     assert(t);
     if (!deco)
     {
+        TypeConsEntry key;
+        int consed = typeConsKey(this, &key);
+        if (consed)
+        {
+            if (!typeConsDim)
+                typeConsGrow();
+            TypeConsEntry *e = *typeConsFind(&key);
+            if (e)
+                return e->t;
+        }
+
         OutBuffer buf;
         StringValue *sv;
 
@@ -1688,6 +1804,21 @@ Type *Type::merge()
             }
             //printf("new value, deco = '%s' %p\n", t->deco, t->deco);
         }
+
+        if (consed)
+        {
+            if (typeConsCount > typeConsDim * 2)
+                typeConsGrow();
+            TypeConsEntry **pe = typeConsFind(&key);
+            if (!*pe)
+            {   TypeConsEntry *e = (TypeConsEntry *)mem.malloc(sizeof(TypeConsEntry));
+                *e = key;
+                e->chain = NULL;
+                e->t = t;
+                *pe = e;
+                typeConsCount++;
+            }
+        }
     }
     return t;
 }
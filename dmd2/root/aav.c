@@ -9,33 +9,35 @@
 
 #include "aav.h"
 
-static const size_t prime_list[] = {
-              31UL,
-              97UL,            389UL,
-            1543UL,           6151UL,
-           24593UL,          98317UL,
-          393241UL,        1572869UL,
-         6291469UL,       25165843UL,
-       100663319UL,      402653189UL,
-      1610612741UL,     4294967291UL,
-};
+/* The keys are pointers, nearly always interned Identifiers, so they are
+ * compared by address and stored in a flat open-addressed table with
+ * linear probing. Most tables belong to small scopes and never outgrow
+ * the slots inside the AA itself.
+ * The NULL key marks unused slots, its value is kept on the side.
+ */
 
 struct aaA
 {
-    aaA *next;
     Key key;
     Value value;
 };
 
 struct AA
 {
-    aaA* *b;
+    aaA *b;             // b_length slots, b_length is a power of 2
     size_t b_length;
-    size_t nodes;       // total number of aaA nodes
-    aaA* binit[4];      // initial value of b[]
+    size_t nodes;       // number of used slots in b[]
+    bool hasNullKey;
+    Value nullValue;    // value for the NULL key
+    aaA binit[8];       // initial value of b[]
 };
 
-static const AA bbinit = { NULL, };
+static inline size_t hashOf(Key key)
+{
+    // objects are at least 8 byte aligned, so the low bits carry nothing
+    size_t h = (size_t)key;
+    return (h >> 3) ^ (h >> 12) ^ (h >> 21);
+}
 
 /****************************************************
  * Determine number of entries in associative array.
@@ -43,56 +45,81 @@ static const AA bbinit = { NULL, };
 
 size_t _aaLen(AA* aa)
 {
-    return aa ? aa->nodes : 0;
+    return aa ? aa->nodes + aa->hasNullKey : 0;
+}
+
+/* Find the slot holding key, or the unused slot it would go into.
+ */
+static aaA *findSlot(AA* aa, Key key)
+{
+    size_t mask = aa->b_length - 1;
+    size_t i = hashOf(key) & mask;
+    while (1)
+    {   aaA *e = &aa->b[i];
+        if (e->key == key || !e->key)
+            return e;
+        i = (i + 1) & mask;
+    }
+}
+
+/* Double the number of slots.
+ */
+static void grow(AA* aa)
+{
+    aaA *oldb = aa->b;
+    size_t oldlen = aa->b_length;
+
+    aa->b_length = oldlen * 2;
+    aa->b = new aaA[aa->b_length];
+    memset(aa->b, 0, aa->b_length * sizeof(aaA));
+    for (size_t k = 0; k < oldlen; k++)
+    {
+        if (oldb[k].key)
+            *findSlot(aa, oldb[k].key) = oldb[k];
+    }
+    if (oldb != aa->binit)
+        delete[] oldb;
 }
 
 
 /*************************************************
  * Get pointer to value in associative array indexed by key.
  * Add entry for key if it is not already there.
+ * The pointer is only valid until the next entry is added.
  */
 
 Value* _aaGet(AA** paa, Key key)
 {
     //printf("paa = %p\n", paa);
 
-    if (!*paa)
-    {   AA *a = new AA();
-        *a = bbinit;
-        a->b = a->binit;
-        a->b_length = sizeof(a->binit) / sizeof(a->binit[0]);
-        *paa = a;
-        assert((*paa)->b_length == 4);
+    AA *aa = *paa;
+    if (!aa)
+    {   aa = new AA();
+        memset(aa, 0, sizeof(AA));
+        aa->b = aa->binit;
+        aa->b_length = sizeof(aa->binit) / sizeof(aa->binit[0]);
+        *paa = aa;
     }
-    //printf("paa = %p, *paa = %p\n", paa, *paa);
 
-    assert((*paa)->b_length);
-    size_t i = (size_t)key % (*paa)->b_length;
-    aaA** pe = &(*paa)->b[i];
-    aaA *e;
-    while ((e = *pe) != NULL)
+    if (!key)
     {
-        if (key == e->key)
-            return &e->value;
-        pe = &e->next;
+        aa->hasNullKey = true;
+        return &aa->nullValue;
     }
 
-    // Not found, create new elem
-    //printf("create new one\n");
-    e = new aaA();
-    e->next = NULL;
-    e->key = key;
-    e->value = NULL;
-    *pe = e;
+    aaA *e = findSlot(aa, key);
+    if (e->key)
+        return &e->value;
 
-    size_t nodes = ++(*paa)->nodes;
-    //printf("length = %d, nodes = %d\n", paa.a.b.length, nodes);
-    if (nodes > (*paa)->b_length * 4)
+    // Not found, keep the table at most 3/4 full
+    if ((aa->nodes + 1) * 4 > aa->b_length * 3)
     {
-        //printf("rehash\n");
-        _aaRehash(paa);
+        grow(aa);
+        e = findSlot(aa, key);
     }
-
+    e->key = key;
+    e->value = NULL;
+    aa->nodes++;
     return &e->value;
 }
 
@@ -107,67 +134,20 @@ Value _aaGetRvalue(AA* aa, Key key)
     //printf("_aaGetRvalue(key = %p)\n", key);
     if (!aa)
         return NULL;
-
-    size_t len = aa->b_length;
-
-    if (len)
-    {
-        size_t i = (size_t)key % len;
-        aaA* e = aa->b[i];
-        while (e)
-        {
-            if (key == e->key)
-                return e->value;
-            e = e->next;
-        }
-    }
-    return NULL;    // not found
+    if (!key)
+        return aa->nullValue;
+    return findSlot(aa, key)->value;    // NULL if the slot is unused
 }
 
 
 /********************************************
  * Rehash an array.
+ * The table is kept at a size that fits its entries, so there is
+ * nothing to do.
  */
 
 void _aaRehash(AA** paa)
 {
-    //printf("Rehash\n");
-    if (*paa)
-    {
-        AA newb = bbinit;
-        AA *aa = *paa;
-        size_t len = _aaLen(*paa);
-        if (len)
-        {   size_t i;
-
-            for (i = 0; i < sizeof(prime_list)/sizeof(prime_list[0]) - 1; i++)
-            {
-                if (len <= prime_list[i])
-                    break;
-            }
-            len = prime_list[i];
-            newb.b = new aaA*[len];
-            memset(newb.b, 0, len * sizeof(aaA*));
-            newb.b_length = len;
-
-            for (size_t k = 0; k < aa->b_length; k++)
-            {   aaA *e = aa->b[k];
-                while (e)
-                {   aaA* enext = e->next;
-                    size_t j = (size_t)e->key % len;
-                    e->next = newb.b[j];
-                    newb.b[j] = e;
-                    e = enext;
-                }
-            }
-            if (aa->b != aa->binit)
-                delete[] aa->b;
-
-            newb.nodes = aa->nodes;
-        }
-
-        **paa = newb;
-    }
 }
 
 
@@ -1,9 +1,11 @@
 #include "gen/llvm.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "mtype.h"
 #include "module.h"
 #include "declaration.h"
 #include "aggregate.h"
+#include "expression.h"
 
 #include "gen/aa.h"
 #include "gen/runtime.h"
@@ -279,3 +281,129 @@ LLValue* DtoAAEquals(Loc& loc, TOK op, DValue* l, DValue* r)
 }
 
 
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+#if DMDV2
+
+// foreach over an associative array ends up in a call of _aaApply or
+// _aaApply2 (from AssociativeArray.opApply in object.di), which calls the
+// loop body through a delegate for every entry. The walk is emitted inline
+// instead, so once opApply is inlined the body can be as well. This relies
+// on the node layout of rt/aaA.d, and nothing checks that the druntime the
+// program is linked with still has it, so it is only done on request with
+// -inline-aa-foreach:
+//
+//   struct AA  { BB* a; }
+//   struct BB  { aaA*[] b; size_t nodes; TypeInfo keyti; aaA*[4] binit; }
+//   struct aaA { aaA* next; hash_t hash; /* key */ /* value */ }
+//
+// The key directly follows the node header; the value follows the key, whose
+// size is rounded up by aligntsize() (to 16 bytes on 64 bit targets, to the
+// pointer size otherwise). Entries are visited in bucket order, just like the
+// runtime does.
+
+static llvm::cl::opt<bool> inlineAAForeach("inline-aa-foreach",
+    llvm::cl::desc("Iterate associative arrays inline instead of calling _aaApply (relies on the runtime's node layout)"),
+    llvm::cl::ZeroOrMore);
+
+DValue* DtoAAApply(Loc& loc, FuncDeclaration* fdapply, Expressions* arguments)
+{
+    if (!inlineAAForeach || fdapply->linkage != LINKc || !arguments || arguments->dim != 3)
+        return NULL;
+
+    unsigned dim;
+    if (strcmp(fdapply->ident->string, "_aaApply") == 0)
+        dim = 1;
+    else if (strcmp(fdapply->ident->string, "_aaApply2") == 0)
+        dim = 2;
+    else
+        return NULL;
+
+    // the body before painting it to the runtime's dg_t/dg2_t
+    Expression* dgexp = (Expression*)arguments->data[2];
+    while (dgexp->op == TOKcast)
+        dgexp = ((CastExp*)dgexp)->e1;
+    if (!DtoIsApplyDelegate(dgexp->type, dim))
+        return NULL;
+
+    Logger::println("DtoAAApply(): inlining %s", fdapply->ident->string);
+    LOG_SCOPE;
+
+    IRBuilderHelper& ir = gIR->ir;
+
+    LLValue* aa = ((Expression*)arguments->data[0])->toElem(gIR)->getRVal();
+    aa = DtoBitCast(aa, getVoidPtrType());
+    LLValue* keysize = ((Expression*)arguments->data[1])->toElem(gIR)->getRVal();
+    LLValue* dg = dgexp->toElem(gIR)->getRVal();
+
+    // where key and value live in a node
+    uint64_t align = global.params.is64bit ? 16 : PTRSIZE;
+    LLValue* keyoffset = DtoConstSize_t(2 * PTRSIZE);
+    LLValue* valoffset = ir->CreateAdd(keysize, DtoConstSize_t(align - 1), "tmp");
+    valoffset = ir->CreateAnd(valoffset, DtoConstSize_t(~(align - 1)), "tmp");
+    valoffset = ir->CreateAdd(valoffset, keyoffset, "aa.valoffset");
+
+    LLValue* resvar = DtoRawAlloca(LLType::getInt32Ty(gIR->context()), 0, "aa.result");
+    LLValue* idxvar = DtoRawAlloca(DtoSize_t(), 0, "aa.bucketidx");
+    LLValue* nodevar = DtoRawAlloca(getVoidPtrType(), 0, "aa.node");
+    DtoStore(DtoConstUint(0), resvar);
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* initbb = llvm::BasicBlock::Create(gIR->context(), "aa.init", gIR->topfunc(), oldend);
+    llvm::BasicBlock* condbb = llvm::BasicBlock::Create(gIR->context(), "aa.bucketcond", gIR->topfunc(), oldend);
+    llvm::BasicBlock* bucketbb = llvm::BasicBlock::Create(gIR->context(), "aa.bucket", gIR->topfunc(), oldend);
+    llvm::BasicBlock* nodecondbb = llvm::BasicBlock::Create(gIR->context(), "aa.nodecond", gIR->topfunc(), oldend);
+    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(gIR->context(), "aa.body", gIR->topfunc(), oldend);
+    llvm::BasicBlock* nextbb = llvm::BasicBlock::Create(gIR->context(), "aa.nextnode", gIR->topfunc(), oldend);
+    llvm::BasicBlock* stepbb = llvm::BasicBlock::Create(gIR->context(), "aa.nextbucket", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "aa.end", gIR->topfunc(), oldend);
+
+    // an empty AA has no table at all
+    ir->CreateCondBr(ir->CreateIsNotNull(aa, "tmp"), initbb, endbb);
+
+    // load the bucket array BB.b
+    gIR->scope() = IRScope(initbb, endbb);
+    LLValue* nbuckets = DtoLoad(DtoBitCast(aa, getPtrToType(DtoSize_t())), "aa.nbuckets");
+    LLValue* buckets = DtoGEP1(aa, DtoConstSize_t(PTRSIZE), "tmp");
+    buckets = DtoLoad(DtoBitCast(buckets, getPtrToType(getPtrToType(getVoidPtrType()))), "aa.buckets");
+    DtoStore(DtoConstSize_t(0), idxvar);
+    ir->CreateBr(condbb);
+
+    gIR->scope() = IRScope(condbb, endbb);
+    LLValue* idx = DtoLoad(idxvar);
+    ir->CreateCondBr(ir->CreateICmpULT(idx, nbuckets, "tmp"), bucketbb, endbb);
+
+    gIR->scope() = IRScope(bucketbb, endbb);
+    DtoStore(DtoLoad(DtoGEP1(buckets, idx, "tmp")), nodevar);
+    ir->CreateBr(nodecondbb);
+
+    gIR->scope() = IRScope(nodecondbb, endbb);
+    LLValue* node = DtoLoad(nodevar);
+    ir->CreateCondBr(ir->CreateIsNotNull(node, "tmp"), bodybb, stepbb);
+
+    // call the body with pointers to key and value
+    gIR->scope() = IRScope(bodybb, nextbb);
+    std::vector<LLValue*> args;
+    if (dim == 2)
+        args.push_back(DtoGEP1(node, keyoffset, "aa.key"));
+    args.push_back(DtoGEP1(node, valoffset, "aa.value"));
+    LLValue* res = DtoCallApplyDelegate(loc, dgexp->type, dg, args);
+    DtoStore(res, resvar);
+    ir->CreateCondBr(ir->CreateICmpNE(res, DtoConstUint(0), "tmp"), endbb, nextbb);
+
+    // aaA.next
+    gIR->scope() = IRScope(nextbb, stepbb);
+    node = DtoLoad(nodevar);
+    DtoStore(DtoLoad(DtoBitCast(node, getPtrToType(getVoidPtrType()))), nodevar);
+    ir->CreateBr(nodecondbb);
+
+    gIR->scope() = IRScope(stepbb, endbb);
+    DtoStore(ir->CreateAdd(DtoLoad(idxvar), DtoConstSize_t(1), "tmp"), idxvar);
+    ir->CreateBr(condbb);
+
+    gIR->scope() = IRScope(endbb, oldend);
+    return new DImValue(Type::tint32, DtoLoad(resvar));
+}
+
+#endif // DMDV2
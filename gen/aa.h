@@ -5,5 +5,8 @@ DValue* DtoAAIndex(Loc& loc, Type* type, DValue* aa, DValue* key, bool lvalue);
 DValue* DtoAAIn(Loc& loc, Type* type, DValue* aa, DValue* key);
 DValue* DtoAARemove(Loc& loc, DValue* aa, DValue* key);
 LLValue* DtoAAEquals(Loc& loc, TOK op, DValue* l, DValue* r);
+#if DMDV2
+DValue* DtoAAApply(Loc& loc, FuncDeclaration* fdapply, Expressions* arguments);
+#endif
 
 #endif // LDC_GEN_AA_H
@@ -24,6 +24,14 @@
  * toString() call because the string got bumped to memory with one integer
  * register still free. Keeping it untransformed puts the length in a register
  * and the pointer in memory, as printf expects it.
+ *
+ * extern(D) passes structs of other sizes than 1, 2, 4 and 8 bytes in memory
+ * and returns all structs through a hidden pointer. With
+ * -x86-64-d-register-pairs, structs of up to 16 bytes that the C ABI would
+ * pass in registers are instead passed and returned like extern(C) does, in
+ * one or two integer/SSE registers. Dynamic arrays and delegates already
+ * travel as two-element first-class aggregates, which LLVM passes in two
+ * registers and returns in RAX:RDX, so they need no change.
  */
 
 #include "mtype.h"
@@ -41,11 +49,18 @@
 #include "gen/abi-generic.h"
 #include "ir/irfunction.h"
 
+#include "llvm/Support/CommandLine.h"
+
 #include <cassert>
 #include <map>
 #include <string>
 #include <utility>
 
+static llvm::cl::opt<bool> dRegisterPairs("x86-64-d-register-pairs",
+    llvm::cl::desc("x86-64: pass and return structs of up to 16 bytes in registers "
+                   "in extern(D) functions (changes the D ABI)"),
+    llvm::cl::ZeroOrMore);
+
 // Implementation details for extern(C)
 namespace {
     /**
@@ -278,6 +293,31 @@ namespace {
         }
         return LLStructType::get(gIR->context(), parts);
     }
+
+    /**
+     * Whether ty is an extern(D) struct that -x86-64-d-register-pairs passes
+     * and returns in (at most two) registers.
+     */
+    bool isRegisterPair(Type* ty) {
+        ty = ty->toBasetype();
+        if (!dRegisterPairs || ty->ty != Tstruct)
+            return false;
+        if (ty->size() == 0 || ty->size() > 16)
+            return false;
+#if DMDV2
+        // copies of these have to stay where the frontend can see them
+        StructDeclaration* sd = ((TypeStruct*)ty)->sym;
+        if (sd->postblit || sd->dtor)
+            return false;
+#endif
+        Classification cl = classify(ty);
+        if (cl.isMemory || cl.classes[0] == NoClass)
+            return false;
+        for (int i = 0; i < 2; i++)
+            if (cl.classes[i] != Integer && cl.classes[i] != Sse && cl.classes[i] != NoClass)
+                return false;
+        return true;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -408,7 +448,7 @@ bool X86_64TargetABI::returnInArg(TypeFunction* tf) {
             return false;
 #endif
         // All non-structs can be returned in registers.
-        return (rt->ty == Tstruct);
+        return (rt->ty == Tstruct) && !isRegisterPair(rt);
     } else {
         if (rt == Type::tvoid || keepUnchanged(rt))
             return false;
@@ -428,7 +468,7 @@ bool X86_64TargetABI::returnInArg(TypeFunction* tf) {
 bool X86_64TargetABI::passByVal(Type* t) {
     t = t->toBasetype();
     if (linkage() == LINKd) {
-        return t->toBasetype()->ty == Tstruct;
+        return t->ty == Tstruct && !isRegisterPair(t);
     } else {
         // This implements the C calling convention for x86-64.
         // It might not be correct for other calling conventions.
@@ -515,6 +555,12 @@ void X86_64TargetABI::rewriteFunctionType(TypeFunction* tf) {
             Logger::println("Rewriting complex return value");
             fty.ret->rewrite = &swapComplex;
         }
+        // small structs in RAX/RDX or XMM0/XMM1
+        else if (!fty.arg_sret && !fty.ret->byref && isRegisterPair(rt))
+        {
+            Logger::println("Returning struct in registers");
+            fixup(*fty.ret);
+        }
                 
         // IMPLICIT PARAMETERS
 
@@ -561,6 +607,20 @@ void X86_64TargetABI::rewriteFunctionType(TypeFunction* tf) {
                    --xmmcount;
                }
             }
+            else if (!arg.byref && isRegisterPair(ty))
+            {
+                Logger::println("Putting struct in register pair");
+                fixup(arg);
+                arg.attrs = 0;
+                Classification cl = classify(ty);
+                for (int i = 0; i < 2; i++)
+                {
+                    if (cl.classes[i] == Integer && regcount > 0)
+                        --regcount;
+                    else if (cl.classes[i] == Sse && xmmcount > 0)
+                        --xmmcount;
+                }
+            }
             else if (regcount == 0)
             {
                 continue;
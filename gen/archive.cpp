@@ -0,0 +1,182 @@
+#include "gen/archive.h"
+#include "gen/llvm.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include "gen/logger.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool collectArchiveSymbols(ArchiveMember& member, std::string& errstr)
+{
+    llvm::StringRef data(member.data.data(), member.data.size());
+    llvm::OwningPtr<llvm::object::ObjectFile> obj(llvm::object::ObjectFile::createObjectFile(
+        llvm::MemoryBuffer::getMemBuffer(data, member.name, false)));
+    if (!obj)
+    {
+        errstr = "not an object file";
+        return false;
+    }
+
+    llvm::error_code ec;
+    for (llvm::object::symbol_iterator I = obj->begin_symbols(), E = obj->end_symbols();
+         I != E; I.increment(ec))
+    {
+        if (ec)
+            break;
+
+        // the same selection as nm: upper case types are external, U is undefined
+        char type;
+        llvm::StringRef name;
+        if ((ec = I->getNMTypeChar(type)) || (ec = I->getName(name)))
+            break;
+        if (!isupper(type) || type == 'U' || name.empty())
+            continue;
+        member.symbols.push_back(name.str());
+    }
+
+    if (ec)
+    {
+        errstr = ec.message();
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static const size_t headerSize = 60;
+
+// Writes a 60 byte member header. Dates, owners and modes are fixed so the
+// archive only depends on its contents.
+static void writeHeader(llvm::raw_ostream& out, const char* name, size_t size)
+{
+    char buf[headerSize + 1];
+    snprintf(buf, sizeof(buf), "%-16s%-12d%-6d%-6d%-8o%-10lu`\n",
+        name, 0, 0, 0, 0644, (unsigned long)size);
+    out.write(buf, headerSize);
+}
+
+static void writeBigEndian32(llvm::raw_ostream& out, uint32_t v)
+{
+    char buf[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v };
+    out.write(buf, 4);
+}
+
+static size_t padded(size_t size)
+{
+    return (size + 1) & ~(size_t)1;
+}
+
+static std::string baseName(const std::string& path)
+{
+    size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+bool writeArchive(const std::string& path, const std::vector<ArchiveMember*>& members,
+                  std::string& errstr)
+{
+    Logger::println("Writing archive %s with %zu members", path.c_str(), members.size());
+    LOG_SCOPE;
+
+    typedef std::vector<ArchiveMember*>::const_iterator MemberIt;
+    typedef std::vector<std::string>::const_iterator SymbolIt;
+
+    // member names longer than 15 characters go into the "//" table
+    std::string longNames;
+    std::vector<std::string> headerNames;
+    for (MemberIt I = members.begin(), E = members.end(); I != E; ++I)
+    {
+        std::string name = baseName((*I)->name);
+        if (name.length() < 16)
+        {
+            headerNames.push_back(name + "/");
+        }
+        else
+        {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "/%lu", (unsigned long)longNames.length());
+            headerNames.push_back(buf);
+            longNames += name + "/\n";
+        }
+    }
+
+    // size of the symbol index: count, one offset per symbol, names
+    size_t nsymbols = 0, namesSize = 0;
+    for (MemberIt I = members.begin(), E = members.end(); I != E; ++I)
+    {
+        nsymbols += (*I)->symbols.size();
+        for (SymbolIt S = (*I)->symbols.begin(), SE = (*I)->symbols.end(); S != SE; ++S)
+            namesSize += S->length() + 1;
+    }
+    size_t indexSize = 4 + 4 * nsymbols + namesSize;
+
+    // lay out the members
+    size_t offset = 8 + headerSize + padded(indexSize);
+    if (!longNames.empty())
+        offset += headerSize + padded(longNames.length());
+    std::vector<uint32_t> memberOffsets;
+    for (MemberIt I = members.begin(), E = members.end(); I != E; ++I)
+    {
+        memberOffsets.push_back(offset);
+        offset += headerSize + padded((*I)->data.size());
+    }
+    if (offset > 0xFFFFFFFFu)
+    {
+        errstr = "archive exceeds 4GB";
+        return false;
+    }
+
+    llvm::raw_fd_ostream out(path.c_str(), errstr, llvm::raw_fd_ostream::F_Binary);
+    if (!errstr.empty())
+        return false;
+
+    out << "!<arch>\n";
+
+    // symbol index
+    writeHeader(out, "/", indexSize);
+    writeBigEndian32(out, nsymbols);
+    for (size_t i = 0; i < members.size(); i++)
+        for (size_t j = 0; j < members[i]->symbols.size(); j++)
+            writeBigEndian32(out, memberOffsets[i]);
+    for (MemberIt I = members.begin(), E = members.end(); I != E; ++I)
+        for (SymbolIt S = (*I)->symbols.begin(), SE = (*I)->symbols.end(); S != SE; ++S)
+            out.write(S->c_str(), S->length() + 1);
+    if (indexSize & 1)
+        out << '\n';
+
+    // long member names
+    if (!longNames.empty())
+    {
+        writeHeader(out, "//", longNames.length());
+        out << longNames;
+        if (longNames.length() & 1)
+            out << '\n';
+    }
+
+    // the objects themselves
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        const llvm::SmallVector<char, 0>& data = members[i]->data;
+        writeHeader(out, headerNames[i].c_str(), data.size());
+        out.write(data.data(), data.size());
+        if (data.size() & 1)
+            out << '\n';
+    }
+
+    out.close();
+    if (out.has_error())
+    {
+        out.clear_error();
+        errstr = "error writing " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef LDC_GEN_ARCHIVE_H
+#define LDC_GEN_ARCHIVE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include <string>
+#include <vector>
+
+/**
+ * An object file that is kept in memory until it is written into a static
+ * library, together with the external symbols it defines.
+ */
+struct ArchiveMember
+{
+    std::string name;
+    llvm::SmallVector<char, 0> data;
+    std::vector<std::string> symbols;
+
+    ArchiveMember(const std::string& name) : name(name) {}
+};
+
+/**
+ * Fills member.symbols with the external symbols defined by the object in
+ * member.data. They are read from the object's own symbol table, so
+ * symbols only defined in module level asm (naked functions) are included.
+ * @param member Object to index.
+ * @param errstr Set to a description of the problem on failure.
+ * @return true on success.
+ */
+bool collectArchiveSymbols(ArchiveMember& member, std::string& errstr);
+
+/**
+ * Writes a GNU/System V ar archive with a symbol index.
+ * @param path Archive file name.
+ * @param members Objects to store, in link order.
+ * @param errstr Set to a description of the problem on failure.
+ * @return true on success.
+ */
+bool writeArchive(const std::string& path, const std::vector<ArchiveMember*>& members,
+                  std::string& errstr);
+
+#endif // LDC_GEN_ARCHIVE_H
@@ -5,6 +5,7 @@
 #include "dsymbol.h"
 #include "aggregate.h"
 #include "declaration.h"
+#include "expression.h"
 #include "init.h"
 
 #include "gen/irstate.h"
@@ -19,6 +20,8 @@
 
 #include "gen/cl_options.h"
 
+#include <set>
+
 //////////////////////////////////////////////////////////////////////////////////////////
 
 static LLValue *DtoSlice(DValue *dval)
@@ -108,6 +111,137 @@ void DtoSetArrayToNull(LLValue* v)
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+// Fills of at least this many bytes store one element and then double it
+// with memcpy, smaller ones use a store loop.
+static const uint64_t fillMemcpyThreshold = 256;
+
+// Width of the vector stores used to fill arrays of scalars.
+static const unsigned fillVectorBytes = 16;
+
+// A loop with a size_t counter kept in a phi.
+struct FillLoop
+{
+    llvm::BasicBlock* oldend;
+    llvm::BasicBlock* condbb;
+    llvm::BasicBlock* endbb;
+    llvm::PHINode* counter;
+};
+
+// Starts a loop counting from begin while below end and returns the
+// counter. The body goes into the current block until endFillLoop.
+static LLValue* beginFillLoop(FillLoop& loop, LLValue* begin, LLValue* end, const char* name)
+{
+    loop.oldend = gIR->scopeend();
+    loop.condbb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.cond", gIR->topfunc(), loop.oldend);
+    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.body", gIR->topfunc(), loop.oldend);
+    loop.endbb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.end", gIR->topfunc(), loop.oldend);
+
+    llvm::BasicBlock* entrybb = gIR->scopebb();
+    assert(!gIR->scopereturned());
+    llvm::BranchInst::Create(loop.condbb, entrybb);
+
+    gIR->scope() = IRScope(loop.condbb, bodybb);
+    loop.counter = llvm::PHINode::Create(DtoSize_t(), 2, name, loop.condbb);
+    loop.counter->addIncoming(begin, entrybb);
+    LLValue* cond = gIR->ir->CreateICmpULT(loop.counter, end, "arrayinit.condition");
+    llvm::BranchInst::Create(bodybb, loop.endbb, cond, gIR->scopebb());
+
+    gIR->scope() = IRScope(bodybb, loop.endbb);
+    return loop.counter;
+}
+
+static void endFillLoop(FillLoop& loop, LLValue* step)
+{
+    LLValue* next = gIR->ir->CreateAdd(loop.counter, step, "arrayinit.next");
+    loop.counter->addIncoming(next, gIR->scopebb());
+    llvm::BranchInst::Create(loop.condbb, gIR->scopebb());
+    gIR->scope() = IRScope(loop.endbb, loop.oldend);
+}
+
+// Assigns value to the elements [begin, end) one at a time.
+static void DtoArrayInitLoop(Loc& loc, LLValue* ptr, LLValue* begin, LLValue* end,
+                             Type* elemty, DValue* value, int op)
+{
+    FillLoop loop;
+    LLValue* i = beginFillLoop(loop, begin, end, "arrayinit.itr");
+    DValue* arrayelem = new DVarValue(elemty, DtoGEP1(ptr, i, "arrayinit.arrayelem"));
+    DtoAssign(loc, arrayelem, value, op);
+    endFillLoop(loop, DtoConstSize_t(1));
+}
+
+// Returns the number of scalars of type t that make up a fill vector, or 0
+// if t can't be filled with vector stores.
+static unsigned getFillVectorWidth(LLType* t)
+{
+    if (!t->isIntegerTy() && !t->isFloatingPointTy())
+        return 0;
+    uint64_t size = getTypePaddedSize(t);
+    if (getTypeBitSize(t) != size * 8 || fillVectorBytes % size != 0)
+        return 0;
+    return fillVectorBytes / size;
+}
+
+// Small fills of scalars: splat vector stores, then the remaining elements.
+static void DtoArrayInitVectorLoop(Loc& loc, LLValue* ptr, LLValue* dim, Type* elemty,
+                                   DValue* value, int op, LLValue* val, unsigned width)
+{
+    LLType* elemType = val->getType();
+    llvm::VectorType* vecType = llvm::VectorType::get(elemType, width);
+    LLValue* vec = llvm::UndefValue::get(vecType);
+    for (unsigned i = 0; i < width; i++)
+        vec = gIR->ir->CreateInsertElement(vec, val, DtoConstUint(i), "arrayinit.splat");
+
+    LLValue* nvecs = gIR->ir->CreateUDiv(dim, DtoConstSize_t(width), "arrayinit.nvecs");
+    LLValue* vecptr = DtoBitCast(ptr, getPtrToType(vecType));
+
+    FillLoop loop;
+    LLValue* i = beginFillLoop(loop, DtoConstSize_t(0), nvecs, "arrayinit.vecitr");
+    llvm::StoreInst* store = gIR->ir->CreateStore(vec, DtoGEP1(vecptr, i, "arrayinit.vecelem"));
+    store->setAlignment(getABITypeAlign(elemType));
+    endFillLoop(loop, DtoConstSize_t(1));
+
+    LLValue* tail = gIR->ir->CreateMul(nvecs, DtoConstSize_t(width), "arrayinit.tail");
+    DtoArrayInitLoop(loc, ptr, tail, dim, elemty, value, op);
+}
+
+// Large fills: assign the first element, then copy what's already filled
+// behind it until the array is full. dim must not be 0.
+static void DtoArrayInitDoubling(Loc& loc, LLValue* ptr, LLValue* dim, Type* elemty,
+                                 DValue* value, int op)
+{
+    DtoAssign(loc, new DVarValue(elemty, ptr), value, op);
+
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(ptr->getType()->getContainedType(0)));
+    FillLoop loop;
+    LLValue* done = beginFillLoop(loop, DtoConstSize_t(1), dim, "arrayinit.done");
+    LLValue* left = gIR->ir->CreateSub(dim, done, "arrayinit.left");
+    LLValue* n = gIR->ir->CreateSelect(gIR->ir->CreateICmpULT(done, left, "tmp"), done, left, "arrayinit.n");
+    DtoMemCpy(DtoGEP1(ptr, done, "arrayinit.dst"), ptr, gIR->ir->CreateMul(n, elemSize, "tmp"));
+    endFillLoop(loop, n);
+}
+
+// If every byte of the constant v is the same, returns that byte.
+static LLValue* getRepeatingByte(LLValue* v)
+{
+    llvm::APInt bits;
+    if (llvm::ConstantInt* ci = llvm::dyn_cast<llvm::ConstantInt>(v))
+        bits = ci->getValue();
+    else if (llvm::ConstantFP* cf = llvm::dyn_cast<llvm::ConstantFP>(v))
+        bits = cf->getValueAPF().bitcastToAPInt();
+    else
+        return NULL;
+
+    unsigned nbits = bits.getBitWidth();
+    if (nbits % 8 != 0 || getTypePaddedSize(v->getType()) * 8 != nbits)
+        return NULL;
+
+    uint64_t byte = bits.trunc(8).getZExtValue();
+    for (unsigned i = 8; i < nbits; i += 8)
+        if (bits.lshr(i).trunc(8).getZExtValue() != byte)
+            return NULL;
+    return DtoConstUbyte(byte);
+}
+
 void DtoArrayInit(Loc& loc, DValue* array, DValue* value, int op)
 {
     Logger::println("DtoArrayInit");
@@ -136,47 +270,61 @@ void DtoArrayInit(Loc& loc, DValue* array, DValue* value, int op)
         return;
     }
 
-    // create blocks
-    llvm::BasicBlock* oldend = gIR->scopeend();
-    llvm::BasicBlock* condbb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.cond",
-                                                        gIR->topfunc(), oldend);
-    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.body",
-                                                        gIR->topfunc(), oldend);
-    llvm::BasicBlock* endbb  = llvm::BasicBlock::Create(gIR->context(), "arrayinit.end",
-                                                        gIR->topfunc(), oldend);
-
-    // initialize iterator
-    LLValue *itr = DtoAlloca(Type::tsize_t, "arrayinit.itr");
-    DtoStore(DtoConstSize_t(0), itr);
-
-    // move into the for condition block, ie. start the loop
-    assert(!gIR->scopereturned());
-    llvm::BranchInst::Create(condbb, gIR->scopebb());
+    LLType* elemType = ptr->getType()->getContainedType(0);
+    uint64_t elemSize = getTypePaddedSize(elemType);
+    bool isScalar = val->getType() == elemType;
 
-    // replace current scope
-    gIR->scope() = IRScope(condbb,bodybb);
+    // bytes and values made of a single repeated byte are a memset as well
+    if (isScalar && elemType->isIntegerTy() && elemSize == 1)
+    {
+        LLValue* byte = gIR->ir->CreateZExt(val, LLType::getInt8Ty(gIR->context()), "tmp");
+        DtoMemSet(ptr, byte, dim);
+        return;
+    }
+    if (LLValue* byte = isScalar ? getRepeatingByte(val) : NULL)
+    {
+        LLValue* nbytes = gIR->ir->CreateMul(dim, DtoConstSize_t(elemSize), ".nbytes");
+        DtoMemSet(ptr, byte, nbytes);
+        return;
+    }
 
-    // create the condition
-    LLValue* cond_val = gIR->ir->CreateICmpNE(DtoLoad(itr), dim, "arrayinit.condition");
+    unsigned width = isScalar ? getFillVectorWidth(elemType) : 0;
+    LLValue* nbytes = gIR->ir->CreateMul(dim, DtoConstSize_t(elemSize), ".nbytes");
 
-    // conditional branch
-    assert(!gIR->scopereturned());
-    llvm::BranchInst::Create(bodybb, endbb, cond_val, gIR->scopebb());
+    // pick the strategy at compile time if the length is known
+    if (llvm::ConstantInt* cnbytes = llvm::dyn_cast<llvm::ConstantInt>(nbytes))
+    {
+        if (cnbytes->isZero())
+            return;
+        if (cnbytes->getZExtValue() >= fillMemcpyThreshold)
+            DtoArrayInitDoubling(loc, ptr, dim, arrayelemty, value, op);
+        else if (width)
+            DtoArrayInitVectorLoop(loc, ptr, dim, arrayelemty, value, op, val, width);
+        else
+            DtoArrayInitLoop(loc, ptr, DtoConstSize_t(0), dim, arrayelemty, value, op);
+        return;
+    }
 
-    // rewrite scope
-    gIR->scope() = IRScope(bodybb, endbb);
+    // otherwise at run time
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* largebb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.large", gIR->topfunc(), oldend);
+    llvm::BasicBlock* smallbb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.small", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "arrayinit.exit", gIR->topfunc(), oldend);
 
-    // assign array element value
-    DValue *arrayelem = new DVarValue(arrayelemty, DtoGEP1(ptr, DtoLoad(itr), "arrayinit.arrayelem"));
-    DtoAssign(loc, arrayelem, value, op);
+    LLValue* large = gIR->ir->CreateICmpUGE(nbytes, DtoConstSize_t(fillMemcpyThreshold), "arrayinit.islarge");
+    llvm::BranchInst::Create(largebb, smallbb, large, gIR->scopebb());
 
-    // increment iterator
-    DtoStore(gIR->ir->CreateAdd(DtoLoad(itr), DtoConstSize_t(1), "arrayinit.new_itr"), itr);
+    gIR->scope() = IRScope(largebb, smallbb);
+    DtoArrayInitDoubling(loc, ptr, dim, arrayelemty, value, op);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
 
-    // loop
-    llvm::BranchInst::Create(condbb, gIR->scopebb());
+    gIR->scope() = IRScope(smallbb, endbb);
+    if (width)
+        DtoArrayInitVectorLoop(loc, ptr, dim, arrayelemty, value, op, val, width);
+    else
+        DtoArrayInitLoop(loc, ptr, DtoConstSize_t(0), dim, arrayelemty, value, op);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
 
-    // rewrite the scope
     gIR->scope() = IRScope(endbb, oldend);
 }
 
@@ -531,6 +679,79 @@ LLConstant* DtoConstSlice(LLConstant* dim, LLConstant* ptr, Type *type)
     return LLConstantStruct::get(lltype, valuesRef);
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+
+// Whether toConstElem can build e without emitting any code.
+static bool isConstArrayElement(Expression* e)
+{
+    switch (e->op)
+    {
+    case TOKint64:
+    case TOKfloat64:
+    case TOKcomplex80:
+    case TOKnull:
+    case TOKstring:
+        return true;
+
+    case TOKarrayliteral: {
+        Expressions* elements = ((ArrayLiteralExp*)e)->elements;
+        for (size_t i = 0; i < elements->dim; i++)
+            if (!isConstArrayElement((Expression*)elements->data[i]))
+                return false;
+        return true;
+    }
+
+    case TOKstructliteral: {
+        StructLiteralExp* se = (StructLiteralExp*)e;
+        // nested structs need a context pointer
+        if (se->sd->isNested())
+            return false;
+        Expressions* elements = se->elements;
+        for (size_t i = 0; i < elements->dim; i++)
+        {
+            Expression* elem = (Expression*)elements->data[i];
+            if (elem && !isConstArrayElement(elem))
+                return false;
+        }
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+LLConstant* DtoArrayLiteralStorage(ArrayLiteralExp* e)
+{
+    size_t len = e->elements->dim;
+    if (len == 0)
+        return NULL;
+
+    for (size_t i = 0; i < len; i++)
+        if (!isConstArrayElement((Expression*)e->elements->data[i]))
+            return NULL;
+
+    Logger::println("DtoArrayLiteralStorage: %s", e->toChars());
+    LOG_SCOPE;
+
+    std::vector<LLConstant*> vals(len, NULL);
+    for (size_t i = 0; i < len; i++)
+    {
+        vals[i] = ((Expression*)e->elements->data[i])->toConstElem(gIR);
+        // struct literals of unions have their own llvm types
+        if (vals[i]->getType() != vals[0]->getType())
+            return NULL;
+    }
+
+    LLArrayType* arrtype = LLArrayType::get(vals[0]->getType(), len);
+    LLGlobalVariable* store = new LLGlobalVariable(*gIR->module, arrtype, true,
+        LLGlobalValue::InternalLinkage, LLConstantArray::get(arrtype, vals), ".arrayliteral");
+    store->setUnnamedAddr(true);
+
+    LLType* elemPtrType = getPtrToType(DtoTypeNotVoid(e->type->toBasetype()->nextOf()));
+    return llvm::ConstantExpr::getBitCast(DtoGEPi(store, 0, 0), elemPtrType);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 static bool isInitialized(Type* et) {
     // Strip static array types from element type
@@ -592,6 +813,8 @@ DSliceValue* DtoNewDynArray(Loc& loc, Type* arrayType, DValue* dim, bool default
 
     // call allocator
     LLValue* newArray = gIR->CreateCallOrInvoke2(fn, arrayTypeInfo, arrayLen, ".gc_mem").getInstruction();
+    DtoAllocProfile(loc, arrayType->toChars(), gIR->ir->CreateMul(arrayLen,
+        DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(eltType))), ".nbytes"));
 
     return getSlice(arrayType, newArray);
 
@@ -602,6 +825,8 @@ DSliceValue* DtoNewDynArray(Loc& loc, Type* arrayType, DValue* dim, bool default
 
     // call allocator
     LLValue* newptr = gIR->CreateCallOrInvoke2(fn, arrayTypeInfo, arrayLen, ".gc_mem").getInstruction();
+    DtoAllocProfile(loc, arrayType->toChars(), gIR->ir->CreateMul(arrayLen,
+        DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(eltType))), ".nbytes"));
 
     // cast to wanted type
     LLType* dstType = DtoType(arrayType)->getContainedType(1);
@@ -618,6 +843,23 @@ DSliceValue* DtoNewDynArray(Loc& loc, Type* arrayType, DValue* dim, bool default
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
+
+// Bytes allocated by new T[d0][d1]...: the slices of every inner level plus
+// the elements at the leaves.
+static LLValue* mulDimAllocSize(const std::vector<LLValue*>& dims, Type* vtype)
+{
+    LLValue* count = DtoConstSize_t(1);
+    LLValue* nbytes = DtoConstSize_t(0);
+    for (size_t i = 0; i < dims.size(); ++i)
+    {
+        count = gIR->ir->CreateMul(count, dims[i], ".count");
+        Type* t = i + 1 < dims.size() ? Type::tvoid->arrayOf() : vtype;
+        LLValue* size = DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(t)));
+        nbytes = gIR->ir->CreateAdd(nbytes, gIR->ir->CreateMul(count, size), ".nbytes");
+    }
+    return nbytes;
+}
+
 DSliceValue* DtoNewMulDimDynArray(Loc& loc, Type* arrayType, DValue** dims, size_t ndims, bool defaultInit)
 {
     Logger::println("DtoNewMulDimDynArray : %s", arrayType->toChars());
@@ -646,11 +888,14 @@ DSliceValue* DtoNewMulDimDynArray(Loc& loc, Type* arrayType, DValue** dims, size
     args.push_back(DtoConstSize_t(ndims));
 
     // build dims
+    std::vector<LLValue*> dimVals;
     for (size_t i=0; i<ndims; ++i)
-        args.push_back(dims[i]->getRVal());
+        dimVals.push_back(dims[i]->getRVal());
+    args.insert(args.end(), dimVals.begin(), dimVals.end());
 
     // call allocator
     LLValue* newptr = gIR->CreateCallOrInvoke(fn, args, ".gc_mem").getInstruction();
+    DtoAllocProfile(loc, arrayType->toChars(), mulDimAllocSize(dimVals, vtype));
 
     if (Logger::enabled())
         Logger::cout() << "final ptr = " << *newptr << '\n';
@@ -664,15 +909,18 @@ DSliceValue* DtoNewMulDimDynArray(Loc& loc, Type* arrayType, DValue** dims, size
     // build dims
     LLValue* dimsArg = DtoArrayAlloca(Type::tsize_t, ndims, ".newdims");
     LLValue* firstDim = NULL;
+    std::vector<LLValue*> dimVals;
     for (size_t i=0; i<ndims; ++i)
     {
         LLValue* dim = dims[i]->getRVal();
         if (!firstDim) firstDim = dim;
         DtoStore(dim, DtoGEPi1(dimsArg, i));
+        dimVals.push_back(dim);
     }
 
     // call allocator
     LLValue* newptr = gIR->CreateCallOrInvoke3(fn, arrayTypeInfo, DtoConstSize_t(ndims), dimsArg, ".gc_mem").getInstruction();
+    DtoAllocProfile(loc, arrayType->toChars(), mulDimAllocSize(dimVals, vtype));
 
     // cast to wanted type
     LLType* dstType = DtoType(arrayType)->getContainedType(1);
@@ -736,6 +984,181 @@ DSliceValue* DtoResizeDynArray(Type* arrayType, DValue* array, LLValue* newdim)
 //////////////////////////////////////////////////////////////////////////////////////////
 #if DMDV2
 
+// With -inline-appends, appends in loops keep a per-variable cache that
+// describes the GC block the slice lived in right after the last append that
+// went through the runtime: { ptr, used, width, start, limit }. The runtime
+// keeps the used length of an appendable block inside the block; used points
+// to that field and width is its size, start is the offset of ptr from the
+// start of the data and limit the largest used length the block can hold.
+// _d_appendcache_fill in the ldc-appendcache library fills the cache, it is
+// the only code that knows where rt/lifetime.d puts the field. While the
+// variable still starts at the cached ptr and the block's used length ends
+// exactly where the variable does, an append that stays within limit is done
+// inline by bumping the used length like the runtime would, so other slices
+// of the block and .capacity see the same state as after a runtime append.
+// A block can only lose room if the GC frees or shrinks it, and that takes a
+// call, so DtoDropAppendCaches resets the caches after every call that could
+// do it.
+// Fields are keyed on their declaration, so all instances share one cache;
+// that costs hits but can't make the check pass wrongly.
+static LLValue* DtoAppendCache(DValue* array)
+{
+    if (!opts::inlineAppends)
+        return NULL;
+
+    DVarValue* var = array->isVar();
+    if (!var || !var->var || var->var->isDataseg())
+        return NULL;
+
+    // the runtime updates the used length of shared arrays atomically
+    if (array->getType()->toBasetype()->nextOf()->isShared())
+        return NULL;
+
+    // only worth the extra runtime call if we append repeatedly
+    FuncGen* gen = gIR->func()->gen;
+    bool inLoop = false;
+    for (size_t i = 0; i < gen->targetScopes.size(); i++)
+        if (gen->targetScopes[i].continueTarget)
+            inLoop = true;
+    if (!inLoop)
+        return NULL;
+
+    LLValue*& cache = gen->appendCaches[var->var];
+    if (!cache)
+    {
+        std::vector<LLType*> types;
+        types.push_back(getVoidPtrType());
+        types.push_back(getVoidPtrType());
+        types.push_back(DtoSize_t());
+        types.push_back(DtoSize_t());
+        types.push_back(DtoSize_t());
+        LLStructType* cacheType = LLStructType::get(gIR->context(), types);
+        cache = DtoRawAlloca(cacheType, 0, ".appendcache");
+        // allocas are at the very top, so is the initialization
+        new llvm::StoreInst(LLConstant::getNullValue(cacheType), cache, gIR->topallocapoint());
+    }
+    return cache;
+}
+
+// Branches to a new block if n more elements fit behind array according to
+// the cache, to slowbb otherwise. The new block bumps the length of array
+// and is left as the current block for the caller to finish. Returns the
+// old length.
+static LLValue* DtoAppendFastPath(Type* arrayType, DValue* array, LLValue* cache, LLValue* n, llvm::BasicBlock* slowbb)
+{
+    IRBuilderHelper& ir = gIR->ir;
+    LLValue* len = DtoArrayLen(array);
+    LLValue* ptr = DtoBitCast(DtoArrayPtr(array), getVoidPtrType());
+    LLValue* newLen = ir->CreateAdd(len, n, ".newlen");
+
+    // used lengths are in bytes from the start of the data
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(arrayType->nextOf())));
+    LLValue* start = DtoLoad(DtoGEPi(cache, 0, 3));
+    LLValue* end = ir->CreateAdd(start, ir->CreateMul(len, elemSize, "tmp"), "tmp");
+    LLValue* newEnd = ir->CreateAdd(start, ir->CreateMul(newLen, elemSize, "tmp"), "tmp");
+
+    LLValue* fits = ir->CreateICmpEQ(ptr, DtoLoad(DtoGEPi(cache, 0, 0)), "tmp");
+    fits = ir->CreateAnd(fits, ir->CreateICmpULE(newEnd, DtoLoad(DtoGEPi(cache, 0, 4)), "tmp"), "tmp");
+
+    llvm::BasicBlock* checkbb = llvm::BasicBlock::Create(gIR->context(), "appendcheck", gIR->topfunc(), slowbb);
+    llvm::BasicBlock* fastbb = llvm::BasicBlock::Create(gIR->context(), "appendfast", gIR->topfunc(), slowbb);
+    llvm::BranchInst::Create(checkbb, slowbb, fits, gIR->scopebb());
+
+    // compare and bump the used length, a width of 0 means the block can't
+    // be appended to in place
+    gIR->scope() = IRScope(checkbb, slowbb);
+    LLValue* used = DtoLoad(DtoGEPi(cache, 0, 1));
+    llvm::SwitchInst* sw = ir->CreateSwitch(DtoLoad(DtoGEPi(cache, 0, 2)), slowbb, 3);
+    const size_t widths[3] = { 1, 2, getTypePaddedSize(DtoSize_t()) };
+    for (size_t i = 0; i < 3; i++)
+    {
+        LLType* fieldType = LLIntegerType::get(gIR->context(), widths[i] * 8);
+        llvm::BasicBlock* usedbb = llvm::BasicBlock::Create(gIR->context(), "appendused", gIR->topfunc(), fastbb);
+        llvm::BasicBlock* bumpbb = llvm::BasicBlock::Create(gIR->context(), "appendbump", gIR->topfunc(), fastbb);
+        sw->addCase(DtoConstSize_t(widths[i]), usedbb);
+
+        gIR->scope() = IRScope(usedbb, bumpbb);
+        LLValue* field = DtoBitCast(used, getPtrToType(fieldType));
+        LLValue* atEnd = ir->CreateICmpEQ(DtoLoad(field), ir->CreateTrunc(end, fieldType, "tmp"), "tmp");
+        llvm::BranchInst::Create(bumpbb, slowbb, atEnd, gIR->scopebb());
+
+        gIR->scope() = IRScope(bumpbb, fastbb);
+        DtoStore(ir->CreateTrunc(newEnd, fieldType, "tmp"), field);
+        llvm::BranchInst::Create(fastbb, gIR->scopebb());
+    }
+
+    gIR->scope() = IRScope(fastbb, slowbb);
+    DtoStore(newLen, DtoGEPi(array->getLVal(), 0, 0));
+    return len;
+}
+
+// After an append through the runtime, records the block that now holds
+// array in the cache.
+static void DtoUpdateAppendCache(DValue* array, LLValue* cache)
+{
+    LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_appendcache_fill");
+    LLValue* ptr = DtoBitCast(DtoArrayPtr(array), getVoidPtrType());
+    gIR->CreateCallOrInvoke2(fn, ptr, DtoBitCast(cache, getVoidPtrType()));
+}
+
+// Whether the callee of call could free or shrink a GC block. Of the runtime
+// functions only the ones behind delete can, the GC interface isn't declared
+// there.
+static bool DtoMayShrinkBlocks(LLCallSite call)
+{
+    LLFunction* fn = call.getCalledFunction();
+    if (!fn)
+        return true;
+    if (fn->isIntrinsic())
+        return false;
+    llvm::StringRef name = fn->getName();
+    if (name.startswith("_d_del"))
+        return true;
+    return !LLVM_D_IsRuntimeFunction(name);
+}
+
+void DtoDropAppendCaches(LLFunction* func, FuncGen* gen)
+{
+    FuncGen::AppendCacheMap& caches = gen->appendCaches;
+    // where to reset the caches, after the call or at the start of the
+    // blocks an invoke continues in
+    std::vector<llvm::Instruction*> points;
+    std::set<llvm::BasicBlock*> blocks;
+    for (LLFunction::iterator bb = func->begin(); bb != func->end(); ++bb)
+    {
+        for (llvm::BasicBlock::iterator it = bb->begin(); it != bb->end(); ++it)
+        {
+            LLCallSite call(&*it);
+            if (!call || !DtoMayShrinkBlocks(call))
+                continue;
+            if (llvm::InvokeInst* invoke = llvm::dyn_cast<llvm::InvokeInst>(&*it))
+            {
+                if (blocks.insert(invoke->getNormalDest()).second)
+                    points.push_back(&*invoke->getNormalDest()->getFirstInsertionPt());
+                if (blocks.insert(invoke->getUnwindDest()).second)
+                    points.push_back(&*invoke->getUnwindDest()->getFirstInsertionPt());
+            }
+            else
+            {
+                llvm::BasicBlock::iterator next = it;
+                points.push_back(&*++next);
+            }
+        }
+    }
+
+    // a zeroed cache has width 0, which sends the next append through the
+    // runtime
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        FuncGen::AppendCacheMap::iterator it, end = caches.end();
+        for (it = caches.begin(); it != end; ++it)
+        {
+            LLType* cacheType = it->second->getType()->getContainedType(0);
+            new llvm::StoreInst(LLConstant::getNullValue(cacheType), it->second, points[i]);
+        }
+    }
+}
+
 void DtoCatAssignElement(Loc& loc, Type* arrayType, DValue* array, Expression* exp)
 {
     Logger::println("DtoCatAssignElement");
@@ -749,14 +1172,36 @@ void DtoCatAssignElement(Loc& loc, Type* arrayType, DValue* array, Expression* e
     // otherwise a ~= a[$-i] won't work correctly
     DValue *expVal = exp->toElem(gIR);
 
+    // inline fast path if there is room left
+    LLValue* cache = DtoAppendCache(array);
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* joinbb = NULL;
+    if (cache)
+    {
+        llvm::BasicBlock* slowbb = llvm::BasicBlock::Create(gIR->context(), "appendslow", gIR->topfunc(), oldend);
+        joinbb = llvm::BasicBlock::Create(gIR->context(), "appendend", gIR->topfunc(), oldend);
+        DtoAppendFastPath(arrayType, array, cache, DtoConstSize_t(1), slowbb);
+        llvm::BranchInst::Create(joinbb, gIR->scopebb());
+        gIR->scope() = IRScope(slowbb, joinbb);
+    }
+
     LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_arrayappendcTX");
     LLSmallVector<LLValue*,3> args;
     args.push_back(DtoTypeInfoOf(arrayType));
     args.push_back(DtoBitCast(array->getLVal(), fn->getFunctionType()->getParamType(1)));
     args.push_back(DtoConstSize_t(1));
+    LLValue* oldPtr = DtoArrayPtr(array);
 
     LLValue* appendedArray = gIR->CreateCallOrInvoke(fn, args, ".appendedArray").getInstruction();
     appendedArray = DtoAggrPaint(appendedArray, DtoType(arrayType));
+    DtoAllocProfileMove(loc, arrayType->toChars(), oldPtr, DtoExtractValue(appendedArray, 1));
+
+    if (cache)
+    {
+        DtoUpdateAppendCache(array, cache);
+        llvm::BranchInst::Create(joinbb, gIR->scopebb());
+        gIR->scope() = IRScope(joinbb, oldend);
+    }
 
     LLValue* val = DtoArrayPtr(array);
     val = DtoGEP1(val, oldLength, "lastElem");
@@ -796,6 +1241,28 @@ DSliceValue* DtoCatAssignArray(DValue* arr, Expression* exp)
     LOG_SCOPE;
     Type *arrayType = arr->getType();
 
+    // byte[] y
+    DValue *e = exp->toElem(gIR);
+    LLValue *y = DtoSlice(e);
+
+    // inline fast path if there is room left, the runtime does the postblits
+    LLValue* cache = arrayNeedsPostblit(arrayType) ? NULL : DtoAppendCache(arr);
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* joinbb = NULL;
+    if (cache)
+    {
+        llvm::BasicBlock* slowbb = llvm::BasicBlock::Create(gIR->context(), "appendslow", gIR->topfunc(), oldend);
+        joinbb = llvm::BasicBlock::Create(gIR->context(), "appendend", gIR->topfunc(), oldend);
+
+        LLValue* len2 = DtoArrayLen(e);
+        LLValue* len1 = DtoAppendFastPath(arrayType, arr, cache, len2, slowbb);
+        LLValue* dst = DtoGEP1(DtoArrayPtr(arr), len1, "tmp");
+        LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(arrayType->nextOf())));
+        DtoMemCpy(dst, DtoArrayPtr(e), gIR->ir->CreateMul(len2, elemSize, "tmp"));
+        llvm::BranchInst::Create(joinbb, gIR->scopebb());
+        gIR->scope() = IRScope(slowbb, joinbb);
+    }
+
     // Prepare arguments
     LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_arrayappendT");
     LLSmallVector<LLValue*,3> args;
@@ -804,14 +1271,23 @@ DSliceValue* DtoCatAssignArray(DValue* arr, Expression* exp)
     // byte[] *px
     args.push_back(DtoBitCast(arr->getLVal(), fn->getFunctionType()->getParamType(1)));
     // byte[] y
-    LLValue *y = DtoSlice(exp->toElem(gIR));
     y = DtoAggrPaint(y, fn->getFunctionType()->getParamType(2));
     args.push_back(y);
+    LLValue* oldPtr = DtoArrayPtr(arr);
 
     // Call _d_arrayappendT
     LLValue* newArray = gIR->CreateCallOrInvoke(fn, args, ".appendedArray").getInstruction();
+    DtoAllocProfileMove(exp->loc, arrayType->toChars(), oldPtr, DtoExtractValue(newArray, 1));
 
-    return getSlice(arrayType, newArray);
+    if (!cache)
+        return getSlice(arrayType, newArray);
+
+    DtoUpdateAppendCache(arr, cache);
+    llvm::BranchInst::Create(joinbb, gIR->scopebb());
+    gIR->scope() = IRScope(joinbb, oldend);
+
+    // both paths updated the variable
+    return new DSliceValue(arrayType, DtoArrayLen(arr), DtoArrayPtr(arr));
 }
 
 #else
@@ -852,11 +1328,9 @@ DSliceValue* DtoCatAssignArray(DValue* arr, Expression* exp)
 
 #if DMDV2
 
-DSliceValue* DtoCatArrays(Type* arrayType, Expression* exp1, Expression* exp2)
+// Concatenation through the runtime, which also runs the postblits.
+static DSliceValue* DtoCatArraysRuntime(Type* arrayType, Expression* exp1, Expression* exp2)
 {
-    Logger::println("DtoCatAssignArray");
-    LOG_SCOPE;
-
     std::vector<LLValue*> args;
     LLFunction* fn = 0;
 
@@ -897,119 +1371,109 @@ DSliceValue* DtoCatArrays(Type* arrayType, Expression* exp1, Expression* exp2)
     }
 
     LLValue *newArray = gIR->CreateCallOrInvoke(fn, args, ".appendedArray").getInstruction();
+    DtoAllocProfile(exp1->loc, arrayType->toChars(), gIR->ir->CreateMul(DtoExtractValue(newArray, 0),
+        DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(arrayType->nextOf()))), ".nbytes"));
     return getSlice(arrayType, newArray);
 }
 
-#else
+#endif
 
-DSliceValue* DtoCatArrays(Type* type, Expression* exp1, Expression* exp2)
+static int arrayDepth(Type* t)
 {
-    Logger::println("DtoCatArrays");
-    LOG_SCOPE;
-
-    Type* t1 = exp1->type->toBasetype();
-    Type* t2 = exp2->type->toBasetype();
-
-    assert(t1->ty == Tarray || t1->ty == Tsarray);
-    assert(t2->ty == Tarray || t2->ty == Tsarray);
-
-    DValue* e1 = exp1->toElem(gIR);
-    DValue* e2 = exp2->toElem(gIR);
-
-    llvm::Value *len1, *len2, *src1, *src2, *res;
-
-    len1 = DtoArrayLen(e1);
-    len2 = DtoArrayLen(e2);
-    res = gIR->ir->CreateAdd(len1,len2,"tmp");
-
-    DValue* lenval = new DImValue(Type::tsize_t, res);
-    DSliceValue* slice = DtoNewDynArray(exp1->loc, type, lenval, false);
-    LLValue* mem = slice->ptr;
-
-    src1 = DtoArrayPtr(e1);
-    src2 = DtoArrayPtr(e2);
-
-    // first memcpy
-    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(src1->getType()->getContainedType(0)));
-    LLValue* bytelen = gIR->ir->CreateMul(len1, elemSize, "tmp");
-    DtoMemCpy(mem,src1,bytelen);
-
-    // second memcpy
-    mem = gIR->ir->CreateGEP(mem,len1,"tmp");
-    bytelen = gIR->ir->CreateMul(len2, elemSize, "tmp");
-    DtoMemCpy(mem,src2,bytelen);
-
-    return slice;
+    int depth = 0;
+    for (t = t->toBasetype(); t->ty == Tarray || t->ty == Tsarray; t = t->nextOf()->toBasetype())
+        depth++;
+    return depth;
 }
 
-#endif
-
-//////////////////////////////////////////////////////////////////////////////////////////
+// Whether e is a single element or an array of elements when concatenated
+// into arrayType. With arrays of arrays, the nesting depth decides.
+static bool isCatElement(Type* arrayType, Expression* e)
+{
+    return arrayDepth(e->type) < arrayDepth(arrayType);
+}
 
-#if DMDV1
+// Collects the operands of a tree of concatenations, left to right.
+static void DtoCatOperands(Type* arrayType, Expression* e, std::vector<Expression*>& ops)
+{
+    if (e->op == TOKcat && !isCatElement(arrayType, e))
+    {
+        CatExp* ce = (CatExp*)e;
+        DtoCatOperands(arrayType, ce->e1, ops);
+        DtoCatOperands(arrayType, ce->e2, ops);
+    }
+    else
+        ops.push_back(e);
+}
 
-DSliceValue* DtoCatArrayElement(Type* type, Expression* exp1, Expression* exp2)
+DSliceValue* DtoCatArrays(Type* arrayType, Expression* exp1, Expression* exp2)
 {
-    Logger::println("DtoCatArrayElement");
+    Logger::println("DtoCatArrays");
     LOG_SCOPE;
 
-    Type* t1 = exp1->type->toBasetype();
-    Type* t2 = exp2->type->toBasetype();
+    // flatten the whole concatenation tree
+    std::vector<Expression*> ops;
+    DtoCatOperands(arrayType, exp1, ops);
+    DtoCatOperands(arrayType, exp2, ops);
 
-    DValue* e1 = exp1->toElem(gIR);
-    DValue* e2 = exp2->toElem(gIR);
-
-    llvm::Value *len1, *src1, *res;
+#if DMDV2
+    // the runtime runs the postblits, and concatenates two plain arrays
+    // without initializing the new memory first
+    if (arrayNeedsPostblit(arrayType) ||
+        (ops.size() == 2 && !isCatElement(arrayType, ops[0]) && !isCatElement(arrayType, ops[1])))
+        return DtoCatArraysRuntime(arrayType, exp1, exp2);
+#endif
 
-    // handle prefix case, eg. int~int[]
-    if (t2->nextOf() && t1 == t2->nextOf()->toBasetype())
+    // evaluate the operands left to right and sum up the length
+    Type* elemType = arrayType->toBasetype()->nextOf();
+    size_t n = ops.size();
+    std::vector<DValue*> vals(n, NULL);
+    std::vector<LLValue*> lens(n, NULL), ptrs(n, NULL);
+    LLValue* len = DtoConstSize_t(0);
+    for (size_t i = 0; i < n; i++)
     {
-        len1 = DtoArrayLen(e2);
-        res = gIR->ir->CreateAdd(len1,DtoConstSize_t(1),"tmp");
-
-        DValue* lenval = new DImValue(Type::tsize_t, res);
-        DSliceValue* slice = DtoNewDynArray(exp1->loc, type, lenval, false);
-        LLValue* mem = slice->ptr;
-
-        DVarValue* memval = new DVarValue(e1->getType(), mem);
-        DtoAssign(exp1->loc, memval, e1);
-
-        src1 = DtoArrayPtr(e2);
-
-        mem = gIR->ir->CreateGEP(mem,DtoConstSize_t(1),"tmp");
-
-        LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(src1->getType()->getContainedType(0)));
-        LLValue* bytelen = gIR->ir->CreateMul(len1, elemSize, "tmp");
-        DtoMemCpy(mem,src1,bytelen);
-
-
-        return slice;
+        vals[i] = ops[i]->toElem(gIR);
+        if (isCatElement(arrayType, ops[i]))
+        {
+            // take the value now, later operands may change a variable
+            if (DtoIsPassedByRef(elemType))
+            {
+                LLValue* tmp = DtoAlloca(elemType, ".catelem");
+                DtoAssign(ops[i]->loc, new DVarValue(elemType, tmp), vals[i]);
+                vals[i] = new DVarValue(elemType, tmp);
+            }
+            else
+            {
+                vals[i] = new DImValue(ops[i]->type, vals[i]->getRVal());
+            }
+            lens[i] = DtoConstSize_t(1);
+        }
+        else
+        {
+            lens[i] = DtoArrayLen(vals[i]);
+            ptrs[i] = DtoArrayPtr(vals[i]);
+        }
+        len = gIR->ir->CreateAdd(len, lens[i], ".catlen");
     }
-    // handle suffix case, eg. int[]~int
-    else
-    {
-        len1 = DtoArrayLen(e1);
-        res = gIR->ir->CreateAdd(len1,DtoConstSize_t(1),"tmp");
-
-        DValue* lenval = new DImValue(Type::tsize_t, res);
-        DSliceValue* slice = DtoNewDynArray(exp1->loc, type, lenval, false);
-        LLValue* mem = slice->ptr;
-
-        src1 = DtoArrayPtr(e1);
-
-        LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(src1->getType()->getContainedType(0)));
-        LLValue* bytelen = gIR->ir->CreateMul(len1, elemSize, "tmp");
-        DtoMemCpy(mem,src1,bytelen);
 
-        mem = gIR->ir->CreateGEP(mem,len1,"tmp");
-        DVarValue* memval = new DVarValue(e2->getType(), mem);
-        DtoAssign(exp1->loc, memval, e2);
+    // a single allocation for the result
+    DSliceValue* slice = DtoNewDynArray(exp1->loc, arrayType, new DImValue(Type::tsize_t, len), false);
 
-        return slice;
+    // and everything copied into place
+    LLValue* elemSize = DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(elemType)));
+    LLValue* offset = DtoConstSize_t(0);
+    for (size_t i = 0; i < n; i++)
+    {
+        LLValue* dst = DtoGEP1(slice->ptr, offset, "tmp");
+        if (ptrs[i])
+            DtoMemCpy(dst, ptrs[i], gIR->ir->CreateMul(lens[i], elemSize, "tmp"));
+        else
+            DtoAssign(ops[i]->loc, new DVarValue(elemType, dst), vals[i]);
+        offset = gIR->ir->CreateAdd(offset, lens[i], "tmp");
     }
-}
 
-#endif
+    return slice;
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
@@ -1388,6 +1852,359 @@ DValue* DtoCastArray(Loc& loc, DValue* u, Type* to)
     return new DImValue(to, rval);
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+
+// Inline string decoding for foreach.
+//
+// The frontend lowers foreach (dchar c; str) and friends to a call of one of
+// the _aApply[R]cd/wd runtime functions, passing the loop body as a delegate
+// literal. Instead the decoding loop is emitted inline and the body is
+// called directly, which lets the optimizer inline it as well. Code units
+// below 0x80 (or outside the surrogate range for UTF-16) take a fast path;
+// anything that isn't a well formed sequence is handed to the runtime
+// function together with the rest of the string, so invalid input is
+// reported exactly as before. The runtime counts indices from the start of
+// that slice, so for foreach (i, dchar c; str) the keys it passes are
+// rebased by a thunk before the body sees them.
+
+static llvm::BasicBlock* newUtfBlock(const char* name)
+{
+    return llvm::BasicBlock::Create(gIR->context(), name, gIR->topfunc(), gIR->scopeend());
+}
+
+static LLValue* loadCodeUnit(LLValue* ptr, LLValue* idx)
+{
+    LLValue* c = DtoLoad(DtoGEP1(ptr, idx, "tmp"));
+    return gIR->ir->CreateZExt(c, LLType::getInt32Ty(gIR->context()), "tmp");
+}
+
+static LLValue* isContinuationByte(LLValue* c)
+{
+    LLValue* masked = gIR->ir->CreateAnd(c, DtoConstUint(0xC0), "tmp");
+    return gIR->ir->CreateICmpEQ(masked, DtoConstUint(0x80), "tmp");
+}
+
+// Decodes the UTF-8 sequence that starts with the non-ASCII byte c0 at index
+// i and ends before limit. Stores the code point to valvar and returns the
+// index after the sequence; branches to errbb if the input isn't well formed.
+static LLValue* DtoDecodeUtf8(LLValue* ptr, LLValue* i, LLValue* c0, LLValue* limit,
+                              LLValue* valvar, llvm::BasicBlock* errbb)
+{
+    IRBuilderHelper& ir = gIR->ir;
+
+    // sequence length from the lead byte, C0, C1 and F5..FF can't start one
+    LLValue* n = ir->CreateSelect(ir->CreateICmpUGE(c0, DtoConstUint(0xF0), "tmp"),
+        DtoConstSize_t(4), ir->CreateSelect(ir->CreateICmpUGE(c0, DtoConstUint(0xE0), "tmp"),
+            DtoConstSize_t(3), DtoConstSize_t(2), "tmp"), "utf.len");
+    LLValue* ok = ir->CreateAnd(ir->CreateICmpUGE(c0, DtoConstUint(0xC2), "tmp"),
+                                ir->CreateICmpULE(c0, DtoConstUint(0xF4), "tmp"), "tmp");
+    ok = ir->CreateAnd(ok, ir->CreateICmpULE(n, ir->CreateSub(limit, i, "tmp"), "tmp"), "tmp");
+
+    llvm::BasicBlock* seq2bb = newUtfBlock("utf.seq2");
+    llvm::BasicBlock* seq3bb = newUtfBlock("utf.seq3");
+    llvm::BasicBlock* seq4bb = newUtfBlock("utf.seq4");
+    llvm::BasicBlock* switchbb = newUtfBlock("utf.lead");
+    llvm::BasicBlock* donebb = newUtfBlock("utf.decoded");
+    ir->CreateCondBr(ok, switchbb, errbb);
+
+    gIR->scope() = IRScope(switchbb, gIR->scopeend());
+    llvm::SwitchInst* sw = ir->CreateSwitch(n, seq2bb, 2);
+    sw->addCase(DtoConstSize_t(3), seq3bb);
+    sw->addCase(DtoConstSize_t(4), seq4bb);
+
+    for (unsigned len = 2; len <= 4; len++)
+    {
+        gIR->scope() = IRScope(len == 2 ? seq2bb : len == 3 ? seq3bb : seq4bb, gIR->scopeend());
+
+        static const unsigned leadMask[5] = { 0, 0, 0x1F, 0x0F, 0x07 };
+        LLValue* d = ir->CreateAnd(c0, DtoConstUint(leadMask[len]), "tmp");
+        ok = NULL;
+        for (unsigned k = 1; k < len; k++)
+        {
+            LLValue* ck = loadCodeUnit(ptr, ir->CreateAdd(i, DtoConstSize_t(k), "tmp"));
+            LLValue* cont = isContinuationByte(ck);
+            ok = ok ? ir->CreateAnd(ok, cont, "tmp") : cont;
+            d = ir->CreateShl(d, DtoConstUint(6), "tmp");
+            d = ir->CreateOr(d, ir->CreateAnd(ck, DtoConstUint(0x3F), "tmp"), "tmp");
+        }
+
+        // reject overlong forms, surrogates and anything beyond U+10FFFF
+        if (len == 3)
+        {
+            ok = ir->CreateAnd(ok, ir->CreateICmpUGE(d, DtoConstUint(0x800), "tmp"), "tmp");
+            LLValue* surrogate = ir->CreateAnd(d, DtoConstUint(0xF800), "tmp");
+            ok = ir->CreateAnd(ok, ir->CreateICmpNE(surrogate, DtoConstUint(0xD800), "tmp"), "tmp");
+        }
+        else if (len == 4)
+        {
+            ok = ir->CreateAnd(ok, ir->CreateICmpUGE(d, DtoConstUint(0x10000), "tmp"), "tmp");
+            ok = ir->CreateAnd(ok, ir->CreateICmpULE(d, DtoConstUint(0x10FFFF), "tmp"), "tmp");
+        }
+
+        DtoStore(d, valvar);
+        ir->CreateCondBr(ok, donebb, errbb);
+    }
+
+    gIR->scope() = IRScope(donebb, gIR->scopeend());
+    return ir->CreateAdd(i, n, "tmp");
+}
+
+// Decodes the surrogate pair whose high half c0 is at index i and that ends
+// before limit, see DtoDecodeUtf8.
+static LLValue* DtoDecodeUtf16(LLValue* ptr, LLValue* i, LLValue* c0, LLValue* limit,
+                               LLValue* valvar, llvm::BasicBlock* errbb)
+{
+    IRBuilderHelper& ir = gIR->ir;
+
+    LLValue* ok = ir->CreateAnd(ir->CreateICmpUGE(c0, DtoConstUint(0xD800), "tmp"),
+                                ir->CreateICmpULE(c0, DtoConstUint(0xDBFF), "tmp"), "tmp");
+    ok = ir->CreateAnd(ok, ir->CreateICmpUGE(ir->CreateSub(limit, i, "tmp"), DtoConstSize_t(2), "tmp"), "tmp");
+
+    llvm::BasicBlock* pairbb = newUtfBlock("utf.pair");
+    llvm::BasicBlock* donebb = newUtfBlock("utf.decoded");
+    ir->CreateCondBr(ok, pairbb, errbb);
+
+    gIR->scope() = IRScope(pairbb, gIR->scopeend());
+    LLValue* next = ir->CreateAdd(i, DtoConstSize_t(1), "tmp");
+    LLValue* c1 = loadCodeUnit(ptr, next);
+    LLValue* low = ir->CreateAnd(c1, DtoConstUint(0xFC00), "tmp");
+    ok = ir->CreateICmpEQ(low, DtoConstUint(0xDC00), "tmp");
+    LLValue* d = ir->CreateShl(ir->CreateSub(c0, DtoConstUint(0xD800), "tmp"), DtoConstUint(10), "tmp");
+    d = ir->CreateAdd(d, ir->CreateSub(c1, DtoConstUint(0xDC00), "tmp"), "tmp");
+    d = ir->CreateAdd(d, DtoConstUint(0x10000), "tmp");
+    DtoStore(d, valvar);
+    ir->CreateCondBr(ok, donebb, errbb);
+
+    gIR->scope() = IRScope(donebb, gIR->scopeend());
+    return ir->CreateAdd(next, DtoConstSize_t(1), "tmp");
+}
+
+// Returns a delegate of type rtdgty that calls dg with the key (the first
+// parameter) increased by offset.
+static LLValue* DtoRebaseApplyKey(Loc& loc, Type* dgtype, LLValue* dg, LLValue* offset, LLType* rtdgty)
+{
+    TypeFunction* tf = (TypeFunction*)dgtype->toBasetype()->nextOf();
+    DtoType(dgtype);
+    LLFunctionType* fty = DtoExtractFunctionType(rtdgty->getContainedType(1));
+    assert(fty && fty->getNumParams() == 3);
+
+    std::vector<LLType*> types;
+    types.push_back(rtdgty);
+    types.push_back(DtoSize_t());
+    LLType* framety = LLStructType::get(gIR->context(), types);
+
+    // the thunk only depends on the ABI, so one per module is enough
+    llvm::Function* thunk = gIR->module->getFunction(".utf.rebasekey");
+    if (!thunk)
+    {
+        thunk = llvm::Function::Create(fty, llvm::GlobalValue::InternalLinkage, ".utf.rebasekey", gIR->module);
+        thunk->setCallingConv(DtoCallingConv(loc, LINKd));
+
+        llvm::IRBuilder<> b(llvm::BasicBlock::Create(gIR->context(), "entry", thunk));
+        llvm::Function::arg_iterator arg = thunk->arg_begin();
+        LLValue* frame = b.CreateBitCast(arg, getPtrToType(framety));
+        LLValue* inner = b.CreateLoad(b.CreateStructGEP(frame, 0));
+        LLValue* off = b.CreateLoad(b.CreateStructGEP(frame, 1));
+
+        // context first, then the key and the value in ABI order
+        unsigned keyidx = tf->fty.reverseParams ? 2 : 1;
+        std::vector<LLValue*> args;
+        args.push_back(b.CreateExtractValue(inner, 0));
+        for (unsigned k = 1; ++arg != thunk->arg_end(); k++)
+        {
+            if (k != keyidx)
+            {
+                args.push_back(arg);
+                continue;
+            }
+            LLValue* key = b.CreateLoad(b.CreateBitCast(arg, getPtrToType(DtoSize_t())));
+            LLValue* rebased = b.CreateAlloca(DtoSize_t(), 0, "key");
+            b.CreateStore(b.CreateAdd(key, off), rebased);
+            args.push_back(b.CreateBitCast(rebased, arg->getType()));
+        }
+        llvm::CallInst* call = b.CreateCall(b.CreateExtractValue(inner, 1), args);
+        call->setCallingConv(thunk->getCallingConv());
+        b.CreateRet(call);
+    }
+
+    LLValue* frame = DtoRawAlloca(framety, 0, "utf.rebase");
+    DtoStore(DtoAggrPaint(dg, rtdgty), DtoGEPi(frame, 0, 0));
+    DtoStore(offset, DtoGEPi(frame, 0, 1));
+    return DtoAggrPair(rtdgty, DtoBitCast(frame, getVoidPtrType()), thunk);
+}
+
+DValue* DtoApplyUtf(Loc& loc, FuncDeclaration* fdapply, Expressions* arguments)
+{
+    // _aApply[R]cd1, _aApply[R]wd2, ...
+    const char* name = fdapply->ident->string;
+    if (fdapply->linkage != LINKc || strncmp(name, "_aApply", 7) != 0 || !arguments || arguments->dim != 2)
+        return NULL;
+    name += 7;
+    bool reverse = (*name == 'R');
+    if (reverse)
+        name++;
+    if ((name[0] != 'c' && name[0] != 'w') || name[1] != 'd' ||
+        (name[2] != '1' && name[2] != '2') || name[3] != 0)
+        return NULL;
+    bool utf8 = (name[0] == 'c');
+    unsigned dim = name[2] - '0';
+
+    // the body as passed by the frontend, before painting it to the type the
+    // runtime expects: int delegate(ref dchar) or int delegate(ref size_t, ref dchar)
+    Expression* strexp = (Expression*)arguments->data[0];
+    Expression* dgexp = (Expression*)arguments->data[1];
+    while (dgexp->op == TOKcast)
+        dgexp = ((CastExp*)dgexp)->e1;
+    if (!DtoIsApplyDelegate(dgexp->type, dim))
+        return NULL;
+    TypeFunction* tf = (TypeFunction*)dgexp->type->toBasetype()->nextOf();
+    Type* valtype = Parameter::getNth(tf->parameters, dim - 1)->type->toBasetype();
+    Type* keytype = Parameter::getNth(tf->parameters, 0)->type->toBasetype();
+    if (valtype->ty != Tdchar || (dim == 2 && !keytype->isintegral()))
+        return NULL;
+
+    Logger::println("DtoApplyUtf(): inlining %s", fdapply->ident->string);
+    LOG_SCOPE;
+
+    IRBuilderHelper& ir = gIR->ir;
+
+    DValue* str = strexp->toElem(gIR);
+    LLValue* dg = dgexp->toElem(gIR)->getRVal();
+    LLValue* len = DtoArrayLen(str);
+    LLValue* ptr = DtoArrayPtr(str);
+
+    LLValue* valvar = DtoRawAlloca(DtoType(valtype), 0, "utf.value");
+    LLValue* keyvar = NULL;
+    if (dim == 2)
+        keyvar = DtoRawAlloca(DtoType(keytype), 0, "utf.key");
+    LLValue* idxvar = DtoRawAlloca(DtoSize_t(), 0, "utf.index");
+    LLValue* startvar = DtoRawAlloca(DtoSize_t(), 0, "utf.start");
+    LLValue* nextvar = DtoRawAlloca(DtoSize_t(), 0, "utf.next");
+    LLValue* resvar = DtoRawAlloca(LLType::getInt32Ty(gIR->context()), 0, "utf.result");
+
+    DtoStore(DtoConstUint(0), resvar);
+    DtoStore(reverse ? len : DtoConstSize_t(0), idxvar);
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* condbb = llvm::BasicBlock::Create(gIR->context(), "utf.cond", gIR->topfunc(), oldend);
+    llvm::BasicBlock* headbb = llvm::BasicBlock::Create(gIR->context(), "utf.head", gIR->topfunc(), oldend);
+    llvm::BasicBlock* slowbb = llvm::BasicBlock::Create(gIR->context(), "utf.slow", gIR->topfunc(), oldend);
+    llvm::BasicBlock* bodybb = llvm::BasicBlock::Create(gIR->context(), "utf.body", gIR->topfunc(), oldend);
+    llvm::BasicBlock* stepbb = llvm::BasicBlock::Create(gIR->context(), "utf.step", gIR->topfunc(), oldend);
+    llvm::BasicBlock* errbb = llvm::BasicBlock::Create(gIR->context(), "utf.invalid", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "utf.end", gIR->topfunc(), oldend);
+    ir->CreateBr(condbb);
+
+    // condition
+    gIR->scope() = IRScope(condbb, endbb);
+    LLValue* i = DtoLoad(idxvar);
+    LLValue* more = reverse ? ir->CreateICmpNE(i, DtoConstSize_t(0), "tmp")
+                            : ir->CreateICmpULT(i, len, "tmp");
+    ir->CreateCondBr(more, headbb, endbb);
+
+    // fast path: a code unit that is a code point on its own
+    gIR->scope() = IRScope(headbb, endbb);
+    LLValue* start = reverse ? ir->CreateSub(i, DtoConstSize_t(1), "tmp") : i;
+    LLValue* c0 = loadCodeUnit(ptr, start);
+    LLValue* single = utf8 ? ir->CreateICmpULT(c0, DtoConstUint(0x80), "tmp")
+                           : ir->CreateICmpNE(ir->CreateAnd(c0, DtoConstUint(0xF800), "tmp"),
+                                              DtoConstUint(0xD800), "tmp");
+    DtoStore(c0, valvar);
+    DtoStore(start, startvar);
+    DtoStore(reverse ? start : ir->CreateAdd(i, DtoConstSize_t(1), "tmp"), nextvar);
+    ir->CreateCondBr(single, bodybb, slowbb);
+
+    // multi unit sequences
+    gIR->scope() = IRScope(slowbb, endbb);
+    if (!reverse)
+    {
+        LLValue* next = utf8 ? DtoDecodeUtf8(ptr, i, c0, len, valvar, errbb)
+                             : DtoDecodeUtf16(ptr, i, c0, len, valvar, errbb);
+        DtoStore(next, nextvar);
+        ir->CreateBr(bodybb);
+    }
+    else
+    {
+        // find the start of the sequence that ends at i, at most three
+        // continuation bytes back for UTF-8 or one code unit for UTF-16
+        LLValue* seqstart;
+        if (utf8)
+        {
+            llvm::BasicBlock* entrybb = gIR->scopebb();
+            llvm::BasicBlock* backbb = newUtfBlock("utf.back");
+            llvm::BasicBlock* backstepbb = newUtfBlock("utf.backstep");
+            llvm::BasicBlock* leadbb = newUtfBlock("utf.backlead");
+            ir->CreateBr(backbb);
+
+            gIR->scope() = IRScope(backbb, endbb);
+            llvm::PHINode* k = llvm::PHINode::Create(DtoSize_t(), 2, "utf.k", backbb);
+            k->addIncoming(start, entrybb);
+            LLValue* cont = isContinuationByte(loadCodeUnit(ptr, k));
+            cont = ir->CreateAnd(cont, ir->CreateICmpNE(k, DtoConstSize_t(0), "tmp"), "tmp");
+            cont = ir->CreateAnd(cont, ir->CreateICmpULT(ir->CreateSub(i, k, "tmp"), DtoConstSize_t(4), "tmp"), "tmp");
+            ir->CreateCondBr(cont, backstepbb, leadbb);
+
+            gIR->scope() = IRScope(backstepbb, endbb);
+            k->addIncoming(ir->CreateSub(k, DtoConstSize_t(1), "tmp"), backstepbb);
+            ir->CreateBr(backbb);
+
+            gIR->scope() = IRScope(leadbb, endbb);
+            seqstart = k;
+        }
+        else
+        {
+            LLValue* low = ir->CreateICmpUGE(c0, DtoConstUint(0xDC00), "tmp");
+            low = ir->CreateAnd(low, ir->CreateICmpNE(start, DtoConstSize_t(0), "tmp"), "tmp");
+            llvm::BasicBlock* pairbb = newUtfBlock("utf.backpair");
+            ir->CreateCondBr(low, pairbb, errbb);
+            gIR->scope() = IRScope(pairbb, endbb);
+            seqstart = ir->CreateSub(start, DtoConstSize_t(1), "tmp");
+        }
+
+        LLValue* lead = loadCodeUnit(ptr, seqstart);
+        LLValue* next = utf8 ? DtoDecodeUtf8(ptr, seqstart, lead, i, valvar, errbb)
+                             : DtoDecodeUtf16(ptr, seqstart, lead, i, valvar, errbb);
+        DtoStore(seqstart, startvar);
+        DtoStore(seqstart, nextvar);
+        ir->CreateCondBr(ir->CreateICmpEQ(next, i, "tmp"), bodybb, errbb);
+    }
+
+    // call the body
+    gIR->scope() = IRScope(bodybb, stepbb);
+    if (keyvar)
+    {
+        LLType* keyty = keyvar->getType()->getContainedType(0);
+        DtoStore(ir->CreateIntCast(DtoLoad(startvar), keyty, false, "tmp"), keyvar);
+    }
+    std::vector<LLValue*> args;
+    if (keyvar)
+        args.push_back(keyvar);
+    args.push_back(valvar);
+    LLValue* res = DtoCallApplyDelegate(loc, dgexp->type, dg, args);
+    DtoStore(res, resvar);
+    ir->CreateCondBr(ir->CreateICmpNE(res, DtoConstUint(0), "tmp"), endbb, stepbb);
+
+    gIR->scope() = IRScope(stepbb, errbb);
+    DtoStore(DtoLoad(nextvar), idxvar);
+    ir->CreateBr(condbb);
+
+    // let the runtime deal with the rest of the string
+    gIR->scope() = IRScope(errbb, endbb);
+    LLFunction* rtfn = LLVM_D_GetRuntimeFunction(gIR->module, fdapply->ident->string);
+    LLFunctionType* rtty = rtfn->getFunctionType();
+    i = DtoLoad(idxvar);
+    LLValue* rest = reverse ? DtoAggrPair(rtty->getParamType(0), i, ptr)
+                            : DtoAggrPair(rtty->getParamType(0), ir->CreateSub(len, i, "tmp"), DtoGEP1(ptr, i, "tmp"));
+    LLValue* rtdg = (keyvar && !reverse) ? DtoRebaseApplyKey(loc, dgexp->type, dg, i, rtty->getParamType(1))
+                                         : DtoAggrPaint(dg, rtty->getParamType(1));
+    res = gIR->CreateCallOrInvoke2(rtfn, rest, rtdg, "tmp").getInstruction();
+    DtoStore(res, resvar);
+    ir->CreateBr(endbb);
+
+    gIR->scope() = IRScope(endbb, oldend);
+    return new DImValue(Type::tint32, DtoLoad(resvar));
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 void DtoArrayBoundsCheck(Loc& loc, DValue* arr, DValue* index, DValue* lowerBound)
 {
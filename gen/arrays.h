@@ -2,8 +2,10 @@
 #define LLVMC_GEN_ARRAYS_H
 
 struct ArrayInitializer;
+struct ArrayLiteralExp;
 
 struct DSliceValue;
+struct FuncGen;
 
 llvm::StructType* DtoArrayType(Type* arrayTy);
 llvm::StructType* DtoArrayType(LLType* elemTy);
@@ -13,6 +15,10 @@ LLType* DtoConstArrayInitializerType(ArrayInitializer* arrinit);
 LLConstant* DtoConstArrayInitializer(ArrayInitializer* si);
 LLConstant* DtoConstSlice(LLConstant* dim, LLConstant* ptr, Type *type = 0);
 
+// returns a pointer to a read-only copy of the literal's elements if they are
+// all constants, NULL otherwise
+LLConstant* DtoArrayLiteralStorage(ArrayLiteralExp* e);
+
 void DtoArrayCopySlices(DSliceValue* dst, DSliceValue* src);
 void DtoArrayCopyToSlice(DSliceValue* dst, DValue* src);
 
@@ -32,10 +38,12 @@ DSliceValue* DtoResizeDynArray(Type* arrayType, DValue* array, llvm::Value* newd
 
 void DtoCatAssignElement(Loc& loc, Type* type, DValue* arr, Expression* exp);
 DSliceValue* DtoCatAssignArray(DValue* arr, Expression* exp);
-DSliceValue* DtoCatArrays(Type* type, Expression* e1, Expression* e2);
-#if DMDV1
-DSliceValue* DtoCatArrayElement(Type* type, Expression* exp1, Expression* exp2);
+#if DMDV2
+// resets the append caches of gen after every call in func that could free
+// or shrink a GC block
+void DtoDropAppendCaches(llvm::Function* func, FuncGen* gen);
 #endif
+DSliceValue* DtoCatArrays(Type* type, Expression* e1, Expression* e2);
 DSliceValue* DtoAppendDCharToString(DValue* arr, Expression* exp);
 DSliceValue* DtoAppendDCharToUnicodeString(DValue* arr, Expression* exp);
 
@@ -53,6 +61,10 @@ LLValue* DtoArrayPtr(DValue* v);
 
 DValue* DtoCastArray(Loc& loc, DValue* val, Type* to);
 
+// emits a UTF decoding foreach inline instead of calling the _aApply runtime
+// function fdapply, returns NULL if the call can't be replaced
+DValue* DtoApplyUtf(Loc& loc, FuncDeclaration* fdapply, Expressions* arguments);
+
 // generates an array bounds check
 void DtoArrayBoundsCheck(Loc& loc, DValue* arr, DValue* index, DValue* lowerBound = 0);
 
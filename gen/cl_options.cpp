@@ -161,6 +161,13 @@ cl::opt<std::string> jsonFile("Xf",
     cl::value_desc("filename"),
     cl::Prefix);
 
+#if DMDV2
+cl::opt<std::string> jsonDir("Xd",
+    cl::desc("write a JSON file for each module to <directory>"),
+    cl::value_desc("directory"),
+    cl::Prefix);
+#endif
+
 // Header generation options
 static cl::opt<bool, true> doHdrGen("H",
     cl::desc("Generate 'header' file"),
@@ -295,6 +302,14 @@ cl::opt<llvm::CodeModel::Model> mCodeModel("code-model",
         clEnumValN(llvm::CodeModel::Large, "large", "Large code model"),
         clEnumValEnd));
 
+cl::opt<bool> functionSections("function-sections",
+    cl::desc("Emit each function into its own section, lets the linker drop unused ones"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> dataSections("data-sections",
+    cl::desc("Emit each global variable into its own section, lets the linker drop unused ones"),
+    cl::ZeroOrMore);
+
 
 // "Hidden debug switches"
 // Are these ever used?
@@ -383,6 +398,26 @@ cl::opt<bool> linkonceTemplates("linkonce-templates",
     cl::desc("Use linkonce_odr linkage for template symbols instead of weak_odr"),
     cl::ZeroOrMore);
 
+cl::opt<bool> lazyTypeInfo("lazy-typeinfo",
+    cl::desc("Only emit TypeInfo objects that generated code refers to"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> allocProfile("alloc-profile",
+    cl::desc("Instrument GC allocation sites and dump per-site statistics on exit"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> thinLocks("thin-locks",
+    cl::desc("Take uncontended synchronized {} sections without an object with inline atomic code (synchronized (obj) and synchronized methods still call the runtime)"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> thinLockStats("thin-lock-stats",
+    cl::desc("Record per-site lock contention and dump it on exit (implies -thin-locks)"),
+    cl::ZeroOrMore);
+
+cl::opt<bool> inlineAppends("inline-appends",
+    cl::desc("Append to slices in loops inline while their GC block has room"),
+    cl::ZeroOrMore);
+
 static cl::extrahelp footer("\n"
 "-d-debug can also be specified without options, in which case it enables all\n"
 "debug checks (i.e. (asserts, boundchecks, contracts and invariants) as well\n"
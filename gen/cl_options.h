@@ -37,6 +37,9 @@ namespace opts {
     extern cl::opt<std::string> ddocDir;
     extern cl::opt<std::string> ddocFile;
     extern cl::opt<std::string> jsonFile;
+#if DMDV2
+    extern cl::opt<std::string> jsonDir;
+#endif
     extern cl::opt<std::string> hdrDir;
     extern cl::opt<std::string> hdrFile;
     extern cl::list<std::string> versions;
@@ -50,8 +53,15 @@ namespace opts {
     extern cl::opt<std::string> mTargetTriple;
     extern cl::opt<llvm::Reloc::Model> mRelocModel;
     extern cl::opt<llvm::CodeModel::Model> mCodeModel;
+    extern cl::opt<bool> functionSections;
+    extern cl::opt<bool> dataSections;
     extern cl::opt<bool> singleObj;
     extern cl::opt<bool> linkonceTemplates;
+    extern cl::opt<bool> lazyTypeInfo;
+    extern cl::opt<bool> allocProfile;
+    extern cl::opt<bool> thinLocks;
+    extern cl::opt<bool> thinLockStats;
+    extern cl::opt<bool> inlineAppends;
 
     // Arguments to -d-debug
     extern std::vector<std::string> debugArgs;
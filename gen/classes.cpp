@@ -148,6 +148,7 @@ DValue* DtoNewClass(Loc loc, TypeClass* tc, NewExp* newexp)
         llvm::Function* fn = LLVM_D_GetRuntimeFunction(gIR->module, _d_allocclass);
         LLConstant* ci = DtoBitCast(tc->sym->ir.irStruct->getClassInfoSymbol(), DtoType(ClassDeclaration::classinfo->type));
         mem = gIR->CreateCallOrInvoke(fn, ci, ".newclass_gc_alloc").getInstruction();
+        DtoAllocProfile(loc, tc->toChars(), DtoConstSize_t(tc->sym->structsize));
         mem = DtoBitCast(mem, DtoType(tc), ".newclass_gc");
     }
 
@@ -831,6 +831,10 @@ void DtoDefineFunction(FuncDeclaration* fd)
 
     // output function body
     fd->fbody->toIR(gIR);
+#if DMDV2
+    if (!fg.appendCaches.empty())
+        DtoDropAppendCaches(func, &fg);
+#endif
     irfunction->gen = 0;
 
     // TODO: clean up this mess
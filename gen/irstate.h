@@ -4,6 +4,7 @@
 #include <vector>
 #include <deque>
 #include <list>
+#include <map>
 #include <sstream>
 
 #include "root.h"
@@ -168,6 +169,10 @@ struct IRState
     // debug info helper
     llvm::DIBuilder dibuilder;
 
+    // type descriptions already emitted into this module's debug info
+    typedef std::map<Type*, llvm::DIType> DITypeMap;
+    DITypeMap diTypes;
+
     // static ctors/dtors/unittests
     typedef std::list<FuncDeclaration*> FuncDeclList;
     typedef std::list<VarDeclaration*> GatesList;
@@ -1,7 +1,9 @@
 #include "gen/linker.h"
 #include "gen/llvm.h"
 #include "llvm/Linker.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Program.h"
 #if _WIN32
 #include "llvm/Support/SystemUtils.h"
@@ -13,10 +15,14 @@
 
 #define NO_COUT_LOGGER
 #include "gen/logger.h"
+#include "gen/archive.h"
 #include "gen/cl_options.h"
 #include "gen/optimizer.h"
 #include "gen/programs.h"
 
+#include <cctype>
+#include <cstdio>
+
 //////////////////////////////////////////////////////////////////////////////
 
 // Is this useful?
@@ -26,6 +32,11 @@ llvm::cl::opt<bool> quiet("quiet",
     llvm::cl::ZeroOrMore,
     llvm::cl::init(true));
 
+static llvm::cl::opt<bool> externalArchiver("external-ar",
+    llvm::cl::desc("Create static libraries with the system archiver instead of in-process"),
+    llvm::cl::Hidden,
+    llvm::cl::ZeroOrMore);
+
 //////////////////////////////////////////////////////////////////////////////
 
 bool endsWith(const std::string &str, const std::string &end)
@@ -218,32 +229,8 @@ int linkExecutable(const char* argv0)
 
 //////////////////////////////////////////////////////////////////////////////
 
-int linkObjToBinary(bool sharedLib)
+static std::string getBinaryOutputName(bool sharedLib)
 {
-    Logger::println("*** Linking executable ***");
-
-    // error string
-    std::string errstr;
-
-    // find gcc for linking
-    llvm::sys::Path gcc = getGcc();
-    // get a string version for argv[0]
-    const char* gccStr = gcc.c_str();
-
-    // build arguments
-    std::vector<const char*> args;
-
-    // first the program name ??
-    args.push_back(gccStr);
-
-    // object files
-    for (unsigned i = 0; i < global.params.objfiles->dim; i++)
-    {
-        char *p = (char *)global.params.objfiles->data[i];
-        args.push_back(p);
-    }
-
-    // output filename
     std::string output;
     if (!sharedLib && global.params.exefile)
     {   // explicit
@@ -272,47 +259,32 @@ int linkObjToBinary(bool sharedLib)
                 else
                     output.append(libExt);
             }
-            args.push_back("-shared");
         } else if (global.params.os == OSWindows && !endsWith(output, ".exe")) {
             output.append(".exe");
         }
     }
+    return output;
+}
 
-    args.push_back("-o");
-    args.push_back(output.c_str());
-
-    // set the global gExePath
-    gExePath.set(output);
-    assert(gExePath.isValid());
-
-    // create path to exe
-    llvm::sys::Path exedir(llvm::sys::path::parent_path(gExePath.str()));
-    if (!exedir.empty() && !llvm::sys::fs::exists(exedir.str()))
+static void createDirectoryForFileName(const std::string& fileName)
+{
+    std::string errstr;
+    llvm::sys::Path dir(llvm::sys::path::parent_path(fileName.c_str()));
+    if (!dir.empty() && !llvm::sys::fs::exists(dir.str()))
     {
-        exedir.createDirectoryOnDisk(true, &errstr);
+        dir.createDirectoryOnDisk(true, &errstr);
         if (!errstr.empty())
         {
-            error("failed to create path to linking output: %s\n%s", exedir.c_str(), errstr.c_str());
+            error("failed to create path to linking output: %s\n%s", dir.c_str(), errstr.c_str());
             fatal();
         }
     }
+}
 
-    // additional linker switches
-    for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
-    {
-        char *p = (char *)global.params.linkswitches->data[i];
-        args.push_back("-Xlinker");
-        args.push_back(p);
-    }
-
-    // user libs
-    for (unsigned i = 0; i < global.params.libfiles->dim; i++)
-    {
-        char *p = (char *)global.params.libfiles->data[i];
-        args.push_back(p);
-    }
-
-    // default libs
+// Appends the default system libraries for the target OS. Returns whether
+// the OS wants a soname for shared libraries.
+static bool addDefaultLibs(std::vector<const char*>& args)
+{
     bool addSoname = false;
     switch(global.params.os) {
     case OSLinux:
@@ -338,24 +310,30 @@ int linkObjToBinary(bool sharedLib)
         // FIXME: I'd assume kernel32 etc
         break;
     }
+    return addSoname;
+}
 
-    //FIXME: enforce 64 bit
-    if (global.params.is64bit)
-        args.push_back("-m64");
-    else
-        // Assume 32-bit?
-        args.push_back("-m32");
+// Returns the linker flag that discards unreferenced sections, or NULL if
+// nothing was emitted into separate sections. See Module::genmoduleinfo for
+// why ModuleInfos survive the collection.
+static const char* getGcSectionsFlag()
+{
+    if (!opts::functionSections && !opts::dataSections)
+        return NULL;
 
-    OutBuffer buf;
-    if (opts::createSharedLib && addSoname) {
-        std::string soname = opts::soname.getNumOccurrences() == 0 ? output : opts::soname;
-        if (!soname.empty()) {
-            buf.writestring("-Wl,-soname,");
-            buf.writestring(soname.c_str());
-            args.push_back(buf.toChars());
-        }
+    switch (global.params.os) {
+    case OSLinux:
+    case OSFreeBSD:
+        return "--gc-sections";
+    case OSMacOSX:
+        return "-dead_strip";
+    default:
+        return NULL;
     }
+}
 
+static void printLinkCommand(const std::vector<const char*>& args)
+{
     // print link command?
     if (!quiet || global.params.verbose)
     {
@@ -373,13 +351,329 @@ int linkObjToBinary(bool sharedLib)
         if (*I)
             logstr << "'" << *I << "'" << " ";
     logstr << "\n"; // FIXME where's flush ?
+}
 
+//////////////////////////////////////////////////////////////////////////////
+
+// The arguments the gcc driver passes to the system linker around the
+// objects and libraries of a link: crt files, library search paths, the
+// C runtime and libgcc.
+struct LinkTemplate
+{
+    std::vector<std::string> prefix;
+    std::vector<std::string> suffix;
+};
+
+// placeholders used to locate the user part of the driver's link line
+static const char* templateInput = "ldc_link_input.o";
+static const char* templateOutput = "ldc_link_output";
+
+// Splits a command line as printed by gcc -###: arguments are separated by
+// blanks and double-quoted if they contain special characters.
+static void splitCommandLine(llvm::StringRef line, std::vector<std::string>& args)
+{
+    size_t i = 0, n = line.size();
+    while (i < n)
+    {
+        while (i < n && isspace(line[i]))
+            ++i;
+        if (i == n)
+            break;
+
+        std::string arg;
+        bool quoted = false;
+        for (; i < n && (quoted || !isspace(line[i])); ++i)
+        {
+            char c = line[i];
+            if (c == '"')
+                quoted = !quoted;
+            else if (c == '\\' && quoted && i + 1 < n)
+                arg += line[++i];
+            else
+                arg += c;
+        }
+        args.push_back(arg);
+    }
+}
+
+// Runs "gcc -###" on a placeholder link and extracts the linker invocation.
+static bool discoverLinkTemplate(llvm::sys::Path& gcc, bool sharedLib, LinkTemplate& tmpl)
+{
+    Logger::println("Discovering link line of %s", gcc.c_str());
+    LOG_SCOPE;
+
+    std::string errstr;
+    llvm::sys::Path tmpdir = llvm::sys::Path::GetTemporaryDirectory(&errstr);
+    if (tmpdir.empty())
+        return false;
+    llvm::sys::Path errfile(tmpdir);
+    errfile.appendComponent("gcc-link.txt");
+
+    std::vector<const char*> args;
+    args.push_back(gcc.c_str());
+    args.push_back("-###");
+    args.push_back(global.params.is64bit ? "-m64" : "-m32");
+    if (sharedLib)
+        args.push_back("-shared");
+    args.push_back("-o");
+    args.push_back(templateOutput);
+    args.push_back(templateInput);
+    args.push_back(NULL);
+
+    llvm::sys::Path empty;
+    const llvm::sys::Path* redirects[] = { &empty, &empty, &errfile };
+    int status = llvm::sys::Program::ExecuteAndWait(gcc, &args[0], NULL, redirects, 0, 0, &errstr);
+
+    llvm::OwningPtr<llvm::MemoryBuffer> buf;
+    bool ok = status == 0 && !llvm::MemoryBuffer::getFile(errfile.str(), buf);
+    std::vector<std::string> cmd;
+    if (ok)
+    {
+        // the linker command is the last line naming our input
+        llvm::StringRef text = buf->getBuffer();
+        while (!text.empty())
+        {
+            std::pair<llvm::StringRef, llvm::StringRef> split = text.split('\n');
+            text = split.second;
+            if (split.first.find(templateInput) == llvm::StringRef::npos)
+                continue;
+            cmd.clear();
+            splitCommandLine(split.first, cmd);
+        }
+    }
+    tmpdir.eraseFromDisk(true);
+
+    if (cmd.empty())
+        return false;
+
+    tmpl.prefix.clear();
+    tmpl.suffix.clear();
+    std::vector<std::string>* part = &tmpl.prefix;
+    // skip argv[0], that's collect2 or ld
+    for (size_t i = 1; i < cmd.size(); i++)
+    {
+        const std::string& arg = cmd[i];
+        if (arg == "-o" && i + 1 < cmd.size() && cmd[i+1] == templateOutput)
+            i++;
+        else if (arg == templateInput)
+            part = &tmpl.suffix;
+        // the LTO plugin only matters for gcc's own bitcode, and its
+        // resolution file is a per-invocation temporary
+        else if (arg == "-plugin" && i + 1 < cmd.size())
+            i++;
+        else if (arg.compare(0, 12, "-plugin-opt=") == 0)
+            continue;
+        else
+            part->push_back(arg);
+    }
+
+    // without the placeholder, we don't know where the objects go
+    return part == &tmpl.suffix;
+}
+
+static llvm::cl::opt<std::string> linkCache("link-cache",
+    llvm::cl::desc("Cache the C runtime link line discovered from gcc in <dir> (with -linker)"),
+    llvm::cl::value_desc("dir"),
+    llvm::cl::ZeroOrMore);
+
+// The cache file depends on everything that changes the driver's answer.
+static std::string getLinkCacheFile(llvm::sys::Path& gcc, bool sharedLib)
+{
+    std::string key = gcc.str();
+    key += global.params.is64bit ? " -m64" : " -m32";
+    if (sharedLib)
+        key += " -shared";
+    llvm::sys::PathWithStatus gccStat(gcc.str());
+    if (const llvm::sys::FileStatus* st = gccStat.getFileStatus())
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), " %llu", (unsigned long long)st->getTimestamp().toEpochTime());
+        key += buf;
+    }
+
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.length(); i++)
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+
+    char name[40];
+    snprintf(name, sizeof(name), "link-%016llx.txt", hash);
+    llvm::sys::Path file(linkCache);
+    file.appendComponent(name);
+    return file.str();
+}
+
+// The cache holds one argument per line, prefix and suffix separated by a
+// line containing only the placeholder input.
+static bool readLinkCache(const std::string& file, LinkTemplate& tmpl)
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buf;
+    if (llvm::MemoryBuffer::getFile(file, buf))
+        return false;
+
+    std::vector<std::string>* part = &tmpl.prefix;
+    llvm::StringRef text = buf->getBuffer();
+    while (!text.empty())
+    {
+        std::pair<llvm::StringRef, llvm::StringRef> split = text.split('\n');
+        text = split.second;
+        if (split.first == templateInput)
+            part = &tmpl.suffix;
+        else
+            part->push_back(split.first.str());
+    }
+    return part == &tmpl.suffix;
+}
+
+static void writeLinkCache(const std::string& file, const LinkTemplate& tmpl)
+{
+    createDirectoryForFileName(file);
+
+    // write to a temporary and rename, concurrent builds may share the cache
+    std::string tmpname = file + ".tmp";
+    std::string errstr;
+    {
+        llvm::raw_fd_ostream out(tmpname.c_str(), errstr);
+        if (!errstr.empty())
+            return;
+        for (size_t i = 0; i < tmpl.prefix.size(); i++)
+            out << tmpl.prefix[i] << '\n';
+        out << templateInput << '\n';
+        for (size_t i = 0; i < tmpl.suffix.size(); i++)
+            out << tmpl.suffix[i] << '\n';
+    }
+    llvm::sys::Path(tmpname).renamePathOnDisk(llvm::sys::Path(file), &errstr);
+}
+
+static void getLinkTemplate(bool sharedLib, LinkTemplate& tmpl)
+{
+    llvm::sys::Path gcc = getGcc();
+
+    std::string cacheFile;
+    if (!linkCache.empty())
+    {
+        cacheFile = getLinkCacheFile(gcc, sharedLib);
+        if (readLinkCache(cacheFile, tmpl))
+        {
+            Logger::println("Using cached link line %s", cacheFile.c_str());
+            return;
+        }
+        tmpl = LinkTemplate();
+    }
+
+    if (!discoverLinkTemplate(gcc, sharedLib, tmpl))
+    {
+        error("failed to determine the link command of %s, try linking without -linker", gcc.c_str());
+        fatal();
+    }
+
+    if (!cacheFile.empty())
+        writeLinkCache(cacheFile, tmpl);
+}
+
+static llvm::cl::opt<unsigned> linkThreads("link-threads",
+    llvm::cl::desc("Number of threads the linker may use (with -linker=gold or lld)"),
+    llvm::cl::value_desc("N"),
+    llvm::cl::init(0));
+
+// Links by running the linker selected with -linker directly. The C runtime
+// startup files and libraries gcc would add are taken from the driver's own
+// link line (see getLinkTemplate), so the result is the same as linking
+// through gcc, without the driver and collect2 processes in between.
+static int linkObjToBinaryDirect(bool sharedLib, const std::string& output)
+{
+    std::string errstr;
+
+    llvm::sys::Path linker = getLinker();
+
+    LinkTemplate tmpl;
+    getLinkTemplate(sharedLib, tmpl);
+
+    // build arguments
+    std::vector<const char*> args;
+
+    // first the program name
+    args.push_back(linker.c_str());
+
+    // output filename
+    args.push_back("-o");
+    args.push_back(output.c_str());
+
+    // what gcc puts in front of the objects
+    for (size_t i = 0; i < tmpl.prefix.size(); i++)
+        args.push_back(tmpl.prefix[i].c_str());
+
+    // object files
+    for (unsigned i = 0; i < global.params.objfiles->dim; i++)
+    {
+        char *p = (char *)global.params.objfiles->data[i];
+        args.push_back(p);
+    }
+
+    // additional linker switches, already meant for the linker
+    for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
+    {
+        char *p = (char *)global.params.linkswitches->data[i];
+        args.push_back(p);
+    }
+
+    // user libs
+    for (unsigned i = 0; i < global.params.libfiles->dim; i++)
+    {
+        char *p = (char *)global.params.libfiles->data[i];
+        args.push_back(p);
+    }
+
+    // default libs
+    bool addSoname = addDefaultLibs(args);
+
+    std::string soname;
+    if (opts::createSharedLib && addSoname) {
+        soname = opts::soname.getNumOccurrences() == 0 ? output : opts::soname;
+        if (!soname.empty()) {
+            args.push_back("-soname");
+            args.push_back(soname.c_str());
+        }
+    }
+
+    // drop unreferenced sections
+    if (const char* gcSections = getGcSectionsFlag())
+        args.push_back(gcSections);
+
+    // parallel linking
+    std::string threads;
+    if (linkThreads)
+    {
+        llvm::StringRef name = llvm::sys::path::filename(linker.str());
+        char buf[32];
+        if (name.find("gold") != llvm::StringRef::npos)
+        {
+            args.push_back("--threads");
+            snprintf(buf, sizeof(buf), "--thread-count=%u", (unsigned)linkThreads);
+        }
+        else if (name.find("lld") != llvm::StringRef::npos)
+            snprintf(buf, sizeof(buf), "--threads=%u", (unsigned)linkThreads);
+        else
+        {
+            warning("-link-threads is not supported by %s", linker.c_str());
+            buf[0] = 0;
+        }
+        threads = buf;
+        if (!threads.empty())
+            args.push_back(threads.c_str());
+    }
+
+    // C runtime and libgcc
+    for (size_t i = 0; i < tmpl.suffix.size(); i++)
+        args.push_back(tmpl.suffix[i].c_str());
+
+    printLinkCommand(args);
 
     // terminate args list
     args.push_back(NULL);
 
     // try to call linker
-    if (int status = llvm::sys::Program::ExecuteAndWait(gcc, &args[0], NULL, NULL, 0,0, &errstr))
+    if (int status = llvm::sys::Program::ExecuteAndWait(linker, &args[0], NULL, NULL, 0,0, &errstr))
     {
         error("linking failed:\nstatus: %d", status);
         if (!errstr.empty())
@@ -390,28 +684,113 @@ int linkObjToBinary(bool sharedLib)
     return 0;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-
-void createStaticLibrary()
+int linkObjToBinary(bool sharedLib)
 {
-    Logger::println("*** Creating static library ***");
+    Logger::println("*** Linking executable ***");
+
+    // output filename
+    std::string output = getBinaryOutputName(sharedLib);
+
+    // set the global gExePath
+    gExePath.set(output);
+    assert(gExePath.isValid());
+
+    // create path to exe
+    createDirectoryForFileName(output);
+
+    if (useDirectLinker())
+        return linkObjToBinaryDirect(sharedLib, output);
 
     // error string
     std::string errstr;
 
-    // find archiver
-    llvm::sys::Path ar = getArchiver();
+    // find gcc for linking
+    llvm::sys::Path gcc = getGcc();
+    // get a string version for argv[0]
+    const char* gccStr = gcc.c_str();
 
     // build arguments
     std::vector<const char*> args;
 
     // first the program name ??
-    args.push_back(ar.c_str());
+    args.push_back(gccStr);
 
-    // ask ar to create a new library
-    args.push_back("rcs");
+    // object files
+    for (unsigned i = 0; i < global.params.objfiles->dim; i++)
+    {
+        char *p = (char *)global.params.objfiles->data[i];
+        args.push_back(p);
+    }
 
-    // output filename
+    if (sharedLib)
+        args.push_back("-shared");
+
+    args.push_back("-o");
+    args.push_back(output.c_str());
+
+    // additional linker switches
+    for (unsigned i = 0; i < global.params.linkswitches->dim; i++)
+    {
+        char *p = (char *)global.params.linkswitches->data[i];
+        args.push_back("-Xlinker");
+        args.push_back(p);
+    }
+
+    // user libs
+    for (unsigned i = 0; i < global.params.libfiles->dim; i++)
+    {
+        char *p = (char *)global.params.libfiles->data[i];
+        args.push_back(p);
+    }
+
+    // default libs
+    bool addSoname = addDefaultLibs(args);
+
+    // drop unreferenced sections
+    if (const char* gcSections = getGcSectionsFlag())
+    {
+        args.push_back("-Xlinker");
+        args.push_back(gcSections);
+    }
+
+    //FIXME: enforce 64 bit
+    if (global.params.is64bit)
+        args.push_back("-m64");
+    else
+        // Assume 32-bit?
+        args.push_back("-m32");
+
+    OutBuffer buf;
+    if (opts::createSharedLib && addSoname) {
+        std::string soname = opts::soname.getNumOccurrences() == 0 ? output : opts::soname;
+        if (!soname.empty()) {
+            buf.writestring("-Wl,-soname,");
+            buf.writestring(soname.c_str());
+            args.push_back(buf.toChars());
+        }
+    }
+
+    printLinkCommand(args);
+
+    // terminate args list
+    args.push_back(NULL);
+
+    // try to call linker
+    if (int status = llvm::sys::Program::ExecuteAndWait(gcc, &args[0], NULL, NULL, 0,0, &errstr))
+    {
+        error("linking failed:\nstatus: %d", status);
+        if (!errstr.empty())
+            error("message: %s", errstr.c_str());
+        return status;
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static std::string getStaticLibraryName()
+{
     std::string libName;
     if (global.params.objname)
     {   // explicit
@@ -435,6 +814,57 @@ void createStaticLibrary()
         else
             libName.append(libExt);
     }
+    return libName;
+}
+
+bool canArchiveInProcess()
+{
+    if (externalArchiver)
+        return false;
+    return global.params.os == OSLinux || global.params.os == OSFreeBSD;
+}
+
+void createStaticLibrary(const std::vector<ArchiveMember*>& members)
+{
+    Logger::println("*** Creating static library ***");
+
+    std::string libName = getStaticLibraryName();
+    createDirectoryForFileName(libName);
+
+    // objects we emitted to memory are archived without another process
+    if (!members.empty())
+    {
+        if (!quiet || global.params.verbose)
+        {
+            printf("archive %s", libName.c_str());
+            for (size_t i = 0; i < members.size(); i++)
+                printf(" %s", members[i]->name.c_str());
+            printf("\n");
+            fflush(stdout);
+        }
+
+        std::string errstr;
+        if (!writeArchive(libName, members, errstr))
+            error("failed to write static library %s: %s", libName.c_str(), errstr.c_str());
+        return;
+    }
+
+    // error string
+    std::string errstr;
+
+    // find archiver
+    llvm::sys::Path ar = getArchiver();
+
+    // build arguments
+    std::vector<const char*> args;
+
+    // first the program name ??
+    args.push_back(ar.c_str());
+
+    // ask ar to create a new library
+    args.push_back("rcs");
+
+    // output filename
     args.push_back(libName.c_str());
 
     // object files
@@ -444,18 +874,6 @@ void createStaticLibrary()
         args.push_back(p);
     }
 
-    // create path to the library
-    llvm::sys::Path libdir(llvm::sys::path::parent_path(libName.c_str()));
-    if (!libdir.empty() && !llvm::sys::fs::exists(libdir.str()))
-    {
-        libdir.createDirectoryOnDisk(true, &errstr);
-        if (!errstr.empty())
-        {
-            error("failed to create path to linking output: %s\n%s", libdir.c_str(), errstr.c_str());
-            fatal();
-        }
-    }
-
     // print the command?
     if (!quiet || global.params.verbose)
     {
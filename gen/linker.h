@@ -32,10 +32,19 @@ int linkExecutable(const char* argv0);
  */
 int linkObjToBinary(bool sharedLib);
 
+struct ArchiveMember;
+
+/**
+ * Whether static libraries can be written without the system archiver.
+ */
+bool canArchiveInProcess();
+
 /**
  * Create a static library from object files.
+ * @param members Objects emitted to memory. If empty, the object files on
+ *        disk are archived with the system archiver.
 */
-void createStaticLibrary();
+void createStaticLibrary(const std::vector<ArchiveMember*>& members);
 
 /**
  * Delete the executable that was previously linked with linkExecutable.
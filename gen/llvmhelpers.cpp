@@ -33,7 +33,7 @@
 // DYNAMIC MEMORY HELPERS
 ////////////////////////////////////////////////////////////////////////////////////////*/
 
-LLValue* DtoNew(Type* newtype)
+LLValue* DtoNew(Loc& loc, Type* newtype)
 {
     // get runtime function
     llvm::Function* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_allocmemoryT");
@@ -42,6 +42,7 @@ LLValue* DtoNew(Type* newtype)
     assert(isaPointer(ti));
     // call runtime allocator
     LLValue* mem = gIR->CreateCallOrInvoke(fn, ti, ".gc_mem").getInstruction();
+    DtoAllocProfile(loc, newtype->toChars(), DtoConstSize_t(getTypePaddedSize(DtoTypeNotVoid(newtype))));
     // cast
     return DtoBitCast(mem, getPtrToType(DtoType(newtype)), ".gc_mem");
 }
@@ -158,10 +159,73 @@ LLValue* DtoGcMalloc(LLType* lltype, const char* name)
     LLValue *size = DtoConstSize_t(getTypeAllocSize(lltype));
     // call runtime allocator
     LLValue* mem = gIR->CreateCallOrInvoke(fn, size, name).getInstruction();
+    // closures are attributed to the function that needs them
+    DtoAllocProfile(gIR->func()->decl->loc, "closure", size);
     // cast
     return DtoBitCast(mem, getPtrToType(lltype), name);
 }
 
+// Emits the statistics descriptor for the site at loc, what may be null.
+static LLValue* DtoSiteDescriptor(Loc& loc, const char* what, const char* name)
+{
+    // Layout must match Site in runtime/sitestats/sitestats.h:
+    // { Site* next, char* file, char* what, uint line, uint registered,
+    //   ulong count, ulong total }
+    LLType* i8ptr = getVoidPtrType();
+    LLType* i32 = LLType::getInt32Ty(gIR->context());
+    LLType* i64 = LLType::getInt64Ty(gIR->context());
+    LLType* fields[] = { i8ptr, i8ptr, i8ptr, i32, i32, i64, i64 };
+    LLStructType* siteType = LLStructType::get(gIR->context(), llvm::makeArrayRef(fields));
+
+    const char* file = loc.filename ? loc.filename : gIR->dmodule->srcfile->name->toChars();
+    LLConstant* inits[] = {
+        getNullPtr(i8ptr),
+        DtoConstStringPtr(file),
+        what ? DtoConstStringPtr(what) : getNullPtr(i8ptr),
+        DtoConstUint(loc.linnum),
+        DtoConstUint(0),
+        LLConstantInt::get(i64, 0),
+        LLConstantInt::get(i64, 0)
+    };
+    LLConstant* init = LLConstantStruct::get(siteType, llvm::makeArrayRef(inits));
+
+    // the collector links the descriptor into its site list, so it is writable
+    LLGlobalVariable* site = new LLGlobalVariable(*gIR->module, siteType, false,
+        LLGlobalValue::InternalLinkage, init, name);
+    return DtoBitCast(site, i8ptr);
+}
+
+void DtoAllocProfile(Loc& loc, const char* what, LLValue* nbytes)
+{
+    if (!opts::allocProfile)
+        return;
+
+    llvm::Function* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_allocprof_hit");
+    gIR->CreateCallOrInvoke2(fn, DtoSiteDescriptor(loc, what, ".allocsite"), nbytes);
+}
+
+void DtoAllocProfileMove(Loc& loc, const char* what, LLValue* oldptr, LLValue* newptr)
+{
+    if (!opts::allocProfile)
+        return;
+
+    oldptr = DtoBitCast(oldptr, getVoidPtrType());
+    newptr = DtoBitCast(newptr, getVoidPtrType());
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* movedbb = llvm::BasicBlock::Create(gIR->context(), "allocprof.moved", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "allocprof.end", gIR->topfunc(), oldend);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpNE(oldptr, newptr, "tmp"), movedbb, endbb);
+
+    // the collector asks the GC how large the new block is
+    gIR->scope() = IRScope(movedbb, endbb);
+    llvm::Function* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_allocprof_block");
+    gIR->CreateCallOrInvoke2(fn, DtoSiteDescriptor(loc, what, ".allocsite"), newptr);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(endbb, oldend);
+}
+
 /****************************************************************************************/
 /*////////////////////////////////////////////////////////////////////////////////////////
 // ASSERT HELPER
@@ -294,7 +358,17 @@ void EnclosingVolatile::emitCode(IRState * p)
 
 void EnclosingTryFinally::emitCode(IRState * p)
 {
-    if (tf->finalbody)
+    if (selector)
+    {
+        // jump to the shared finally body and continue in a block of our
+        // own once it is done
+        llvm::BasicBlock* exitbb = llvm::BasicBlock::Create(gIR->context(), "finallyexit", p->topfunc(), p->scopeend());
+        exits.push_back(exitbb);
+        DtoStore(DtoConstUint(exits.size()), selector);
+        llvm::BranchInst::Create(finallyBB, p->scopebb());
+        p->scope() = IRScope(exitbb, p->scopeend());
+    }
+    else if (tf->finalbody)
     {
         llvm::BasicBlock* oldpad = p->func()->gen->landingPad;
         p->func()->gen->landingPad = landingPad;
@@ -305,15 +379,16 @@ void EnclosingTryFinally::emitCode(IRState * p)
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-void DtoEnclosingHandlers(Loc loc, Statement* target)
+// labels are a special case: they are not required to enclose the current scope
+// for them we use the enclosing scope handler as a reference point
+static Statement* getJumpScope(Statement* target)
 {
-    // labels are a special case: they are not required to enclose the current scope
-    // for them we use the enclosing scope handler as a reference point
     LabelStatement* lblstmt = target ? target->isLabelStatement() : 0;
-    if (lblstmt)
-        target = lblstmt->enclosingScopeExit;
+    return lblstmt ? lblstmt->enclosingScopeExit : target;
+}
 
-    // figure out up until what handler we need to emit
+static FuncGen::TargetScopeVec::reverse_iterator findTargetScope(Statement* target)
+{
     FuncGen::TargetScopeVec::reverse_iterator targetit = gIR->func()->gen->targetScopes.rbegin();
     FuncGen::TargetScopeVec::reverse_iterator it_end = gIR->func()->gen->targetScopes.rend();
     while(targetit != it_end) {
@@ -322,6 +397,26 @@ void DtoEnclosingHandlers(Loc loc, Statement* target)
         }
         ++targetit;
     }
+    return targetit;
+}
+
+bool DtoEnclosingHandlersShared(Statement* target)
+{
+    FuncGen::TargetScopeVec::reverse_iterator targetit = findTargetScope(getJumpScope(target));
+    FuncGen::TargetScopeVec::reverse_iterator it = gIR->func()->gen->targetScopes.rbegin();
+    for (; it != targetit; ++it)
+        if (it->enclosinghandler && it->enclosinghandler->isShared())
+            return true;
+    return false;
+}
+
+void DtoEnclosingHandlers(Loc loc, Statement* target)
+{
+    // figure out up until what handler we need to emit
+    LabelStatement* lblstmt = target ? target->isLabelStatement() : 0;
+    target = getJumpScope(target);
+    FuncGen::TargetScopeVec::reverse_iterator targetit = findTargetScope(target);
+    FuncGen::TargetScopeVec::reverse_iterator it_end = gIR->func()->gen->targetScopes.rend();
 
     if (target && targetit == it_end) {
         if (lblstmt)
@@ -352,18 +447,176 @@ void DtoEnclosingHandlers(Loc loc, Statement* target)
 // SYNCHRONIZED SECTION HELPERS
 ////////////////////////////////////////////////////////////////////////////////////////*/
 
-void DtoEnterCritical(LLValue* g)
+bool DtoUseThinLocks()
+{
+    // the owner id is the address of a thread-local variable in the
+    // ldc-thinlock library, which needs ELF TLS
+    if (!opts::thinLocks)
+        return false;
+    return global.params.os == OSLinux || global.params.os == OSFreeBSD ||
+           global.params.os == OSSolaris;
+}
+
+LLStructType* DtoThinLockType()
+{
+    // { size_t owner, size_t count }, see runtime/thinlock/thinlock.c
+    return LLStructType::get(gIR->context(), DtoSize_t(), DtoSize_t(), NULL);
+}
+
+// The owner id of the running thread.
+static LLValue* DtoThinLockSelf()
+{
+    const char* name = "_d_thinlock_self";
+    LLGlobalVariable* self = gIR->module->getGlobalVariable(name);
+    if (!self)
+    {
+        LLType* i8 = LLType::getInt8Ty(gIR->context());
+        self = new LLGlobalVariable(*gIR->module, i8, false,
+            LLGlobalValue::ExternalLinkage, NULL, name, NULL, true);
+    }
+    return gIR->ir->CreatePtrToInt(self, DtoSize_t(), "thinlock.self");
+}
+
+// Site descriptor for -thin-lock-stats, or null.
+static LLValue* DtoThinLockSite(Loc& loc)
 {
-    LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_criticalenter");
-    gIR->CreateCallOrInvoke(fn, g);
+    if (!opts::thinLockStats)
+        return getNullPtr(getVoidPtrType());
+    return DtoSiteDescriptor(loc, NULL, ".locksite");
+}
+
+void DtoEnterCritical(Loc& loc, LLValue* g)
+{
+    if (!DtoUseThinLocks())
+    {
+        LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_criticalenter");
+        gIR->CreateCallOrInvoke(fn, g);
+        return;
+    }
+
+    Logger::println("Entering thin lock");
+    LOG_SCOPE;
+
+    LLValue* lock = DtoBitCast(g, getPtrToType(DtoThinLockType()));
+    LLValue* ownerPtr = DtoGEPi(lock, 0, 0, "thinlock.owner");
+    LLValue* countPtr = DtoGEPi(lock, 0, 1, "thinlock.count");
+    LLValue* self = DtoThinLockSelf();
+    LLValue* zero = DtoConstSize_t(0);
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* takenbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.taken", gIR->topfunc(), oldend);
+    llvm::BasicBlock* heldbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.held", gIR->topfunc(), oldend);
+    llvm::BasicBlock* reenterbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.reenter", gIR->topfunc(), oldend);
+    llvm::BasicBlock* slowbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.slow", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.end", gIR->topfunc(), oldend);
+
+    // a free lock is taken with a single cmpxchg
+    LLValue* owner = gIR->ir->CreateAtomicCmpXchg(ownerPtr, zero, self, llvm::Acquire);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(owner, zero), takenbb, heldbb);
+
+    gIR->scope() = IRScope(takenbb, heldbb);
+    DtoStore(DtoConstSize_t(1), countPtr);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    // only the owner touches the count, so re-entering needs no atomics
+    gIR->scope() = IRScope(heldbb, reenterbb);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(owner, self), reenterbb, slowbb);
+
+    gIR->scope() = IRScope(reenterbb, slowbb);
+    LLValue* count = gIR->ir->CreateAdd(DtoLoad(countPtr), DtoConstSize_t(1));
+    DtoStore(count, countPtr);
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    // another thread holds it
+    gIR->scope() = IRScope(slowbb, endbb);
+    LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_thinlock_acquire");
+    gIR->CreateCallOrInvoke3(fn, DtoBitCast(lock, getVoidPtrType()), self, DtoThinLockSite(loc));
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(endbb, oldend);
 }
 
 void DtoLeaveCritical(LLValue* g)
 {
-    LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_criticalexit");
-    gIR->CreateCallOrInvoke(fn, g);
+    if (!DtoUseThinLocks())
+    {
+        LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_criticalexit");
+        gIR->CreateCallOrInvoke(fn, g);
+        return;
+    }
+
+    Logger::println("Leaving thin lock");
+    LOG_SCOPE;
+
+    LLValue* lock = DtoBitCast(g, getPtrToType(DtoThinLockType()));
+    LLValue* ownerPtr = DtoGEPi(lock, 0, 0, "thinlock.owner");
+    LLValue* countPtr = DtoGEPi(lock, 0, 1, "thinlock.count");
+
+    llvm::BasicBlock* oldend = gIR->scopeend();
+    llvm::BasicBlock* releasebb = llvm::BasicBlock::Create(gIR->context(), "thinlock.release", gIR->topfunc(), oldend);
+    llvm::BasicBlock* endbb = llvm::BasicBlock::Create(gIR->context(), "thinlock.end", gIR->topfunc(), oldend);
+
+    LLValue* count = gIR->ir->CreateSub(DtoLoad(countPtr), DtoConstSize_t(1));
+    DtoStore(count, countPtr);
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(count, DtoConstSize_t(0)), releasebb, endbb);
+
+    gIR->scope() = IRScope(releasebb, endbb);
+    llvm::StoreInst* store = gIR->ir->CreateStore(DtoConstSize_t(0), ownerPtr);
+    store->setAtomic(llvm::Release);
+    store->setAlignment(getTypeAllocSize(DtoSize_t()));
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+    gIR->scope() = IRScope(endbb, oldend);
+}
+
+#if DMDV2
+bool DtoCriticalSectionCall(Loc& loc, FuncDeclaration* fdecl, Expressions* arguments)
+{
+    if (!DtoUseThinLocks() || !arguments || arguments->dim != 1)
+        return false;
+
+    // only the storage the frontend allocates for a bare synchronized {}
+    // is known to never reach _d_criticalenter from anywhere else
+    Expression* e = static_cast<Expression*>(arguments->data[0]);
+    while (e->op == TOKcast || e->op == TOKaddress)
+        e = static_cast<UnaExp*>(e)->e1;
+    if (e->op != TOKvar)
+        return false;
+    VarDeclaration* vd = static_cast<VarExp*>(e)->var->isVarDeclaration();
+    if (!vd || !(vd->storage_class & STCgshared) ||
+        strncmp(vd->ident->string, "__critsec", 9) != 0)
+        return false;
+
+    // The lock gets storage of its own instead of the __critsec. In a
+    // template instance that storage is shared between all modules, and one
+    // built without -thin-locks would hand it to _d_criticalenter, which
+    // reads the owner as its list link and skips initializing the mutex.
+    // With separate storage such mixed builds don't exclude each other
+    // inside the instance, but neither corrupts the other's lock.
+    std::string name(vd->mangle());
+    name += ".thinlock";
+    LLGlobalVariable* g = gIR->module->getNamedGlobal(name);
+    if (!g)
+    {
+        LLStructType* type = DtoThinLockType();
+        g = new LLGlobalVariable(*gIR->module, type, false, DtoLinkage(vd),
+            LLConstant::getNullValue(type), name);
+        g->setAlignment(getABITypeAlign(DtoSize_t()));
+    }
+
+    if (fdecl->ident == Id::criticalenter)
+        DtoEnterCritical(loc, g);
+    else
+        DtoLeaveCritical(g);
+    return true;
 }
+#endif
 
+// Object monitors always go through the runtime, even with -thin-locks, so
+// synchronized (obj) and synchronized methods are not sped up by it:
+// druntime allocates the monitor the object points to and core.sync
+// replaces it with its own (a Mutex, which Condition waits on), so the
+// monitor slot can't hold an inline lock without a matching druntime.
 void DtoEnterMonitor(LLValue* v)
 {
     LLFunction* fn = LLVM_D_GetRuntimeFunction(gIR->module, "_d_monitorenter");
@@ -514,11 +767,6 @@ void DtoAssign(Loc& loc, DValue* lhs, DValue* rhs, int op)
         }
         gIR->ir->CreateStore(r, l);
     }
-
-    DVarValue *var = lhs->isVar();
-    VarDeclaration *vd = var ? var->var : 0;
-    if (vd)
-        DtoDwarfValue(DtoLoad(var->getLVal()), vd);
 }
 
 /****************************************************************************************/
@@ -11,14 +11,24 @@
 struct EnclosingHandler
 {
     virtual void emitCode(IRState* p) = 0;
+    // true if emitCode jumps to code shared with other exits, so values
+    // computed before the jump don't dominate the code after it
+    virtual bool isShared() { return false; }
 };
 struct EnclosingTryFinally : EnclosingHandler
 {
     TryFinallyStatement* tf;
     llvm::BasicBlock* landingPad;
+    // if the finally body is emitted only once: its entry block, the variable
+    // selecting where to continue after it and the continuations of the jumps
+    // out of the try body (selector value i+1 for exits[i])
+    llvm::BasicBlock* finallyBB;
+    LLValue* selector;
+    std::vector<llvm::BasicBlock*> exits;
     void emitCode(IRState* p);
+    bool isShared() { return selector != 0; }
     EnclosingTryFinally(TryFinallyStatement* _tf, llvm::BasicBlock* _pad) 
-    : tf(_tf), landingPad(_pad) {}
+    : tf(_tf), landingPad(_pad), finallyBB(0), selector(0) {}
 };
 struct EnclosingVolatile : EnclosingHandler
 {
@@ -35,7 +45,7 @@ struct EnclosingSynchro : EnclosingHandler
 
 
 // dynamic memory helpers
-LLValue* DtoNew(Type* newtype);
+LLValue* DtoNew(Loc& loc, Type* newtype);
 void DtoDeleteMemory(LLValue* ptr);
 void DtoDeleteClass(LLValue* inst);
 void DtoDeleteInterface(LLValue* inst);
@@ -47,6 +57,12 @@ llvm::AllocaInst* DtoArrayAlloca(Type* type, unsigned arraysize, const char* nam
 llvm::AllocaInst* DtoRawAlloca(LLType* lltype, size_t alignment, const char* name = "");
 LLValue* DtoGcMalloc(LLType* lltype, const char* name = "");
 
+/// Records a GC allocation of nbytes of 'what' at loc when -alloc-profile is on.
+void DtoAllocProfile(Loc& loc, const char* what, LLValue* nbytes);
+/// Records the new block when an append at loc moved an array from oldptr to
+/// newptr, appends in place don't allocate.
+void DtoAllocProfileMove(Loc& loc, const char* what, LLValue* oldptr, LLValue* newptr);
+
 // assertion generator
 void DtoAssert(Module* M, Loc loc, DValue* msg);
 
@@ -61,11 +77,26 @@ void DtoGoto(Loc loc, Identifier* target, TryFinallyStatement* sourceFinally);
 // the scope created by the 'target' statement.
 void DtoEnclosingHandlers(Loc loc, Statement* target);
 
+// Checks whether one of the handlers DtoEnclosingHandlers(loc, target) would
+// emit is shared between several exits.
+bool DtoEnclosingHandlersShared(Statement* target);
+
 /// Enters a critical section.
-void DtoEnterCritical(LLValue* g);
+void DtoEnterCritical(Loc& loc, LLValue* g);
 /// leaves a critical section.
 void DtoLeaveCritical(LLValue* g);
 
+/// Whether compiler-owned critical sections are thin locks (-thin-locks).
+bool DtoUseThinLocks();
+/// Returns the type of a thin lock.
+LLStructType* DtoThinLockType();
+
+#if DMDV2
+/// Emits a _d_criticalenter/_d_criticalexit call of a lowered synchronized {}
+/// as a thin lock. Returns false if the call has to go to the runtime.
+bool DtoCriticalSectionCall(Loc& loc, FuncDeclaration* fdecl, Expressions* arguments);
+#endif
+
 /// Enters a monitor lock.
 void DtoEnterMonitor(LLValue* v);
 /// Leaves a monitor lock.
@@ -183,6 +214,14 @@ void DtoBuildDVarArgList(std::vector<LLValue*>& args, llvm::AttrListPtr& palist,
 ///
 DValue* DtoCallFunction(Loc& loc, Type* resulttype, DValue* fnval, Expressions* arguments);
 
+/// Checks whether dgtype is an int delegate taking nparams arguments that
+/// are passed as pointers (by ref or of pointer type), like a foreach body.
+bool DtoIsApplyDelegate(Type* dgtype, size_t nparams);
+
+/// Calls the delegate value dg of type dgtype with the given pointers, as the
+/// runtime's apply functions call foreach bodies. Returns the int result.
+LLValue* DtoCallApplyDelegate(Loc& loc, Type* dgtype, LLValue* dg, const std::vector<LLValue*>& ptrs);
+
 Type* stripModifiers(Type* type);
 
 void printLabelName(std::ostream& target, const char* func_mangle, const char* label_name);
@@ -29,6 +29,7 @@
 #include "json.h"
 
 #include "gen/logger.h"
+#include "gen/archive.h"
 #include "gen/linkage.h"
 #include "gen/linker.h"
 #include "gen/irstate.h"
@@ -45,6 +46,8 @@ using namespace opts;
 
 #if POSIX
 #include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #elif _WIN32
 #include <windows.h>
 #endif
@@ -57,6 +60,14 @@ static cl::opt<bool> noDefaultLib("nodefaultlib",
     cl::desc("Don't add a default library for linking implicitly"),
     cl::ZeroOrMore);
 
+#if POSIX
+static cl::opt<unsigned> jobs("j",
+    cl::desc("Analyse and compile the source files in <n> processes (not with -singleobj, -run, -X or -deps)"),
+    cl::value_desc("n"),
+    cl::Prefix,
+    cl::init(1));
+#endif
+
 static StringsAdapter impPathsStore("I", global.params.imppath);
 static cl::list<std::string, StringsAdapter> importPaths("I",
     cl::desc("Where to look for imports"),
@@ -123,6 +134,109 @@ static void initFromString(char*& dest, const cl::opt<std::string>& src) {
     }
 }
 
+#if POSIX
+static void copyOutput(FILE* from, FILE* to)
+{
+    char buf[4096];
+    size_t n;
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+        fwrite(buf, 1, n, to);
+    fclose(from);
+}
+
+/* Handle -j: fork a process for each job after the root modules have been
+ * parsed. Job k does the semantic analysis and code generation for every
+ * n-th root module starting at k; the other root modules are only imported
+ * there. No frontend state is shared, so nothing needs to be made thread
+ * safe. The output of every job is replayed in job order when all have
+ * finished, so diagnostics come out the same on every run.
+ * Returns true in the parent, which is only left to link the objects.
+ */
+static bool compileInProcesses(Modules& modules, unsigned njobs)
+{
+    if (njobs > modules.dim)
+        njobs = modules.dim;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<pid_t> pids;
+    std::vector<FILE*> outs, errs;
+    for (unsigned k = 0; k < njobs; k++)
+    {
+        FILE* out = tmpfile();
+        FILE* err = tmpfile();
+        if (!out || !err)
+        {
+            error("cannot create temporary files for -j: %s", strerror(errno));
+            fatal();
+        }
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            error("cannot fork for -j: %s", strerror(errno));
+            fatal();
+        }
+        if (pid == 0)
+        {
+            dup2(fileno(out), STDOUT_FILENO);
+            dup2(fileno(err), STDERR_FILENO);
+
+            unsigned n = 0;
+            for (unsigned i = 0; i < modules.dim; i++)
+            {
+                Module* m = (Module*)modules.data[i];
+                if (i % njobs == k)
+                    modules.data[n++] = m;
+                else
+                {
+                    m->isRoot = false;
+#if DMDV2
+                    // still analysed when imported, but only its own job
+                    // prints its errors, so they show up once like with -j1
+                    m->reportedElsewhere = true;
+#endif
+                }
+            }
+            modules.setDim(n);
+
+            // objects are linked or archived by the parent
+            global.params.link = false;
+            createStaticLib = false;
+            return false;
+        }
+
+        pids.push_back(pid);
+        outs.push_back(out);
+        errs.push_back(err);
+    }
+
+    bool failed = false;
+    for (unsigned k = 0; k < njobs; k++)
+    {
+        int status;
+        while (waitpid(pids[k], &status, 0) < 0 && errno == EINTR)
+            ;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = true;
+        copyOutput(outs[k], stdout);
+        copyOutput(errs[k], stderr);
+    }
+    if (failed)
+        fatal();
+
+    for (unsigned i = 0; i < modules.dim; i++)
+    {
+        Module* m = (Module*)modules.data[i];
+        global.params.objfiles->push(m->objfile->name->str);
+    }
+    modules.setDim(0);
+    return true;
+}
+#endif
+
 #if _WIN32 && __DMC__
 extern "C"
 {
@@ -236,6 +350,9 @@ int main(int argc, char** argv)
     initFromString(global.params.xfilename, jsonFile);
     if (global.params.xfilename)
         global.params.doXGeneration = true;
+#if DMDV2
+    initFromString(global.params.xdir, jsonDir);
+#endif
 
     initFromString(global.params.hdrdir, hdrDir);
     initFromString(global.params.hdrname, hdrFile);
@@ -340,6 +457,22 @@ int main(int argc, char** argv)
         }
     }
 
+    // the per-site collector for -alloc-profile lives in its own library
+    if (allocProfile)
+        global.params.linkswitches->push(mem.strdup("-lldc-allocprof"));
+
+    // so does the contended path of -thin-locks
+    if (thinLockStats)
+        thinLocks = true;
+    if (thinLocks)
+        global.params.linkswitches->push(mem.strdup("-lldc-thinlock"));
+
+#if DMDV2
+    // and the code that fills the caches of -inline-appends
+    if (inlineAppends)
+        global.params.linkswitches->push(mem.strdup("-lldc-appendcache"));
+#endif
+
     if (global.params.run)
         quiet = 1;
 
@@ -521,6 +654,11 @@ LDC_TARGETS
                                                                  mRelocModel, mCodeModel);
     gTargetMachine = target;
 
+    // put every symbol into its own section so the linker can
+    // garbage collect unreferenced ones
+    llvm::TargetMachine::setFunctionSections(functionSections);
+    llvm::TargetMachine::setDataSections(dataSections);
+
     gTargetData = target->getTargetData();
 
     // get final data layout
@@ -871,6 +1009,14 @@ LDC_TARGETS
     if (global.errors)
         fatal();
 
+#if POSIX
+    if (jobs > 1 && modules.dim > 1 && !singleObj && !global.params.run &&
+        !global.params.doXGeneration && !global.params.moduleDepsFile)
+    {
+        compileInProcesses(modules, jobs);
+    }
+#endif
+
     // load all unconditional imports for better symbol resolving
     for (unsigned i = 0; i < modules.dim; i++)
     {
@@ -929,8 +1075,7 @@ LDC_TARGETS
          */
         if (!global.params.useArrayBounds && !global.params.useAssert)
 #else
-    // This doesn't play nice with debug info at the moment
-    if (!global.params.symdebug && willInline())
+    if (willInline())
     {
         global.params.useAvailableExternally = true;
         Logger::println("Running some extra semantic3's for inlining purposes");
@@ -963,6 +1108,12 @@ LDC_TARGETS
     if (global.errors || global.warnings)
         fatal();
 
+#if DMDV2
+    if (global.params.verbose)
+        printf("search cache: %u of %u import lookups hit\n",
+            ScopeDsymbol::searchCacheHits, ScopeDsymbol::searchCacheLookups);
+#endif
+
     // write module dependencies to file if requested
     if (global.params.moduleDepsFile != NULL)
     {
@@ -978,6 +1129,12 @@ LDC_TARGETS
     std::vector<llvm::Module*> llvmModules;
     llvm::LLVMContext& context = llvm::getGlobalContext();
 
+    // when building a library only from our own modules, the objects are
+    // kept in memory and archived directly
+    std::vector<ArchiveMember*> libMembers;
+    bool archiveInMemory = createStaticLib && global.params.output_o &&
+        !global.params.objfiles->dim && canArchiveInProcess();
+
     // Generate output files
     for (unsigned i = 0; i < modules.dim; i++)
     {
@@ -990,8 +1147,17 @@ LDC_TARGETS
             if (!singleObj)
             {
                 m->deleteObjFile();
-                writeModule(lm, m->objfile->name->str);
-                global.params.objfiles->push(m->objfile->name->str);
+                if (archiveInMemory)
+                {
+                    ArchiveMember* member = new ArchiveMember(m->objfile->name->str);
+                    writeModule(lm, m->objfile->name->str, member);
+                    libMembers.push_back(member);
+                }
+                else
+                {
+                    writeModule(lm, m->objfile->name->str);
+                    global.params.objfiles->push(m->objfile->name->str);
+                }
                 delete lm;
             }
             else
@@ -1003,6 +1169,12 @@ LDC_TARGETS
         {
             if (global.params.doDocComments)
             m->gendocfile();
+#if DMDV2
+            // written as soon as the module is done so the output can be
+            // picked up while the remaining modules are compiled
+            if (global.params.xdir)
+                json_generate(m, m->buildFilePath(NULL, global.params.xdir, global.json_ext)->toChars());
+#endif
         }
     }
 
@@ -1024,8 +1196,17 @@ LDC_TARGETS
         }
 
         m->deleteObjFile();
-        writeModule(linker.getModule(), filename);
-        global.params.objfiles->push(filename);
+        if (archiveInMemory)
+        {
+            ArchiveMember* member = new ArchiveMember(filename);
+            writeModule(linker.getModule(), filename, member);
+            libMembers.push_back(member);
+        }
+        else
+        {
+            writeModule(linker.getModule(), filename);
+            global.params.objfiles->push(filename);
+        }
     }
 
     // output json file
@@ -1036,7 +1217,7 @@ LDC_TARGETS
     if (global.errors)
         fatal();
 
-    if (!global.params.objfiles->dim)
+    if (!global.params.objfiles->dim && libMembers.empty())
     {
         if (global.params.link)
             error("no object files to link");
@@ -1048,7 +1229,12 @@ LDC_TARGETS
         if (global.params.link)
             status = linkObjToBinary(createSharedLib);
         else if (createStaticLib)
-            createStaticLibrary();
+        {
+            createStaticLibrary(libMembers);
+            for (size_t i = 0; i < libMembers.size(); i++)
+                delete libMembers[i];
+            libMembers.clear();
+        }
 
         if (global.params.run)
         {
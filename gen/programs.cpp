@@ -6,6 +6,8 @@
 #include "root.h"       // error(char*)
 #include "mars.h"       // fatal()
 
+#include <cassert>
+
 using namespace llvm;
 
 static cl::opt<std::string> gcc("gcc",
@@ -13,6 +15,11 @@ static cl::opt<std::string> gcc("gcc",
     cl::Hidden,
     cl::ZeroOrMore);
 
+static cl::opt<std::string> linker("linker",
+    cl::desc("Invoke this linker directly instead of linking through gcc (e.g. ld, gold)"),
+    cl::value_desc("linker"),
+    cl::ZeroOrMore);
+
 static cl::opt<std::string> ar("ar",
     cl::desc("Archiver"),
     cl::Hidden,
@@ -23,7 +30,7 @@ sys::Path getProgram(const char *name, const cl::opt<std::string> &opt, const ch
     const char *prog = NULL;
 
     if (opt.getNumOccurrences() > 0 && opt.length() > 0)
-        prog = gcc.c_str();
+        prog = opt.c_str();
 
     if (!prog && envVar)
         prog = getenv(envVar);
@@ -52,3 +59,25 @@ sys::Path getArchiver()
 {
     return getProgram("ar", ar);
 }
+
+bool useDirectLinker()
+{
+    return linker.getNumOccurrences() > 0 && !linker.empty();
+}
+
+sys::Path getLinker()
+{
+    assert(useDirectLinker());
+
+    // accept short names like "gold" or "bfd" for ld.gold and ld.bfd
+    std::string name = linker;
+    if (name.find('/') == std::string::npos && name.compare(0, 2, "ld") != 0)
+        name = "ld." + name;
+
+    sys::Path path = sys::Program::FindProgramByName(name);
+    if (path.empty()) {
+        error("failed to locate linker %s", name.c_str());
+        fatal();
+    }
+    return path;
+}
@@ -6,4 +6,8 @@
 llvm::sys::Path getGcc();
 llvm::sys::Path getArchiver();
 
+// True if -linker was given, i.e. the linker is run without the gcc driver.
+bool useDirectLinker();
+llvm::sys::Path getLinker();
+
 #endif
@@ -89,6 +89,18 @@ llvm::Function* LLVM_D_GetRuntimeFunction(llvm::Module* target, const char* name
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+bool LLVM_D_IsRuntimeFunction(llvm::StringRef name)
+{
+    if (!M) {
+        assert(!runtime_failed);
+        LLVM_D_InitRuntime();
+    }
+
+    return M->getFunction(name) != NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 llvm::GlobalVariable* LLVM_D_GetRuntimeGlobal(llvm::Module* target, const char* name)
 {
     LLGlobalVariable* gv = target->getNamedGlobal(name);
@@ -410,6 +422,16 @@ static void LLVM_D_BuildRuntimeModule()
     }
 
 #if DMDV2
+    // void _d_appendcache_fill(void* ptr, AppendCache* cache)
+    {
+        llvm::StringRef fname("_d_appendcache_fill");
+        std::vector<LLType*> types;
+        types.push_back(voidPtrTy);
+        types.push_back(voidPtrTy);
+        LLFunctionType* fty = llvm::FunctionType::get(voidTy, types, false);
+        llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage, fname, M)
+            ->setAttributes(Attr_NoUnwind);
+    }
     // byte[] _d_arrayappendcTX(TypeInfo ti, ref byte[] px, size_t n)
     {
         llvm::StringRef fname("_d_arrayappendcTX");
@@ -489,6 +511,40 @@ static void LLVM_D_BuildRuntimeModule()
             ->setAttributes(Attr_NoAlias);
     }
 
+    // void _d_allocprof_hit(Site* site, size_t nbytes)
+    {
+        llvm::StringRef fname("_d_allocprof_hit");
+        std::vector<LLType*> types;
+        types.push_back(voidPtrTy);
+        types.push_back(sizeTy);
+        LLFunctionType* fty = llvm::FunctionType::get(voidTy, types, false);
+        llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage, fname, M)
+            ->setAttributes(Attr_NoUnwind);
+    }
+
+    // void _d_allocprof_block(Site* site, void* p)
+    {
+        llvm::StringRef fname("_d_allocprof_block");
+        std::vector<LLType*> types;
+        types.push_back(voidPtrTy);
+        types.push_back(voidPtrTy);
+        LLFunctionType* fty = llvm::FunctionType::get(voidTy, types, false);
+        llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage, fname, M)
+            ->setAttributes(Attr_NoUnwind);
+    }
+
+    // void _d_thinlock_acquire(ThinLock* lock, size_t self, Site* site)
+    {
+        llvm::StringRef fname("_d_thinlock_acquire");
+        std::vector<LLType*> types;
+        types.push_back(voidPtrTy);
+        types.push_back(sizeTy);
+        types.push_back(voidPtrTy);
+        LLFunctionType* fty = llvm::FunctionType::get(voidTy, types, false);
+        llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage, fname, M)
+            ->setAttributes(Attr_NoUnwind);
+    }
+
 #if DMDV2
 
     // void _d_delarray_t(Array *p, TypeInfo ti)
@@ -10,6 +10,9 @@ llvm::Function* LLVM_D_GetRuntimeFunction(llvm::Module* target, const char* name
 
 llvm::GlobalVariable* LLVM_D_GetRuntimeGlobal(llvm::Module* target, const char* name);
 
+// whether name is one of the runtime functions declared here
+bool LLVM_D_IsRuntimeFunction(llvm::StringRef name);
+
 #if DMDV1
 #define _d_allocclass "_d_allocclass"
 #define _adEq "_adEq"
@@ -7,6 +7,7 @@
 #include "gen/llvm.h"
 #include "llvm/InlineAsm.h"
 #include "llvm/Support/CFG.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "mars.h"
 #include "init.h"
@@ -153,8 +154,17 @@ void ReturnStatement::toIR(IRState* p)
                     Logger::cout() << "return value after cast: " << *v << '\n';
             }
 
-            // emit scopes
+            // emit scopes, the value has to survive a detour through a
+            // shared finally block
+            LLValue* retvar = NULL;
+            if (DtoEnclosingHandlersShared(NULL))
+            {
+                retvar = DtoRawAlloca(v->getType(), 0, "return.value");
+                DtoStore(v, retvar);
+            }
             DtoEnclosingHandlers(loc, NULL);
+            if (retvar)
+                v = DtoLoad(retvar);
 
             DtoDwarfFuncEnd(p->func()->decl);
             llvm::ReturnInst::Create(gIR->context(), v, p->scopebb());
@@ -631,6 +641,40 @@ void OnScopeStatement::toIR(IRState* p)
 
 //////////////////////////////////////////////////////////////////////////////
 
+// Jumps out of a try block (break, continue, return, goto) used to get a copy
+// of the finally body each. Unless it is small, the finally body is now
+// emitted once and every exit stores its number into a selector variable and
+// jumps there; a switch on the selector after the finally body continues on
+// the right path. The copy made for the landing pad is not affected.
+static llvm::cl::opt<unsigned> finallyCopyLimit("finally-copy-limit",
+    llvm::cl::desc("Copy finally blocks of at most this many expression statements into every exit of the try block"),
+    llvm::cl::ZeroOrMore,
+    llvm::cl::init(1));
+
+// Counts the expression statements in a finally body, anything else makes it
+// too large to be copied.
+static unsigned finallySize(Statement* s)
+{
+    if (!s)
+        return 0;
+    if (s->isExpStatement())
+        return 1;
+    if (ScopeStatement* ss = s->isScopeStatement())
+        return finallySize(ss->statement);
+    if (CompoundStatement* cs = s->isCompoundStatement())
+    {
+        unsigned n = 0;
+        for (unsigned i = 0; i < cs->statements->dim; i++)
+        {
+            n += finallySize((Statement*)cs->statements->data[i]);
+            if (n > finallyCopyLimit)
+                break;
+        }
+        return n;
+    }
+    return finallyCopyLimit + 1;
+}
+
 void TryFinallyStatement::toIR(IRState* p)
 {
     Logger::println("TryFinallyStatement::toIR(): %s", loc.toChars());
@@ -677,7 +721,13 @@ void TryFinallyStatement::toIR(IRState* p)
     IRLandingPad& pad = gIR->func()->gen->landingPadInfo;
     pad.addFinally(finalbody);
     pad.push(landingpadbb);
-    gIR->func()->gen->targetScopes.push_back(IRTargetScope(this,new EnclosingTryFinally(this,gIR->func()->gen->landingPad),NULL,NULL));
+    EnclosingTryFinally* handler = new EnclosingTryFinally(this, gIR->func()->gen->landingPad);
+    if (finallySize(finalbody) > finallyCopyLimit)
+    {
+        handler->finallyBB = finallybb;
+        handler->selector = DtoRawAlloca(LLType::getInt32Ty(gIR->context()), 0, "finally.selector");
+    }
+    gIR->func()->gen->targetScopes.push_back(IRTargetScope(this,handler,NULL,NULL));
     gIR->func()->gen->landingPad = pad.get();
 
     //
@@ -692,7 +742,11 @@ void TryFinallyStatement::toIR(IRState* p)
 
     // terminate try BB
     if (!p->scopereturned())
+    {
+        if (handler->selector)
+            DtoStore(DtoConstUint(0), handler->selector);
         llvm::BranchInst::Create(finallybb, p->scopebb());
+    }
 
     pad.pop();
     gIR->func()->gen->landingPad = pad.get();
@@ -709,7 +763,15 @@ void TryFinallyStatement::toIR(IRState* p)
     // terminate finally
     //TODO: isn't it an error to have a 'returned' finally block?
     if (!gIR->scopereturned()) {
-        llvm::BranchInst::Create(endbb, p->scopebb());
+        if (handler->exits.empty()) {
+            llvm::BranchInst::Create(endbb, p->scopebb());
+        } else {
+            // continue where the try block was left
+            LLValue* sel = DtoLoad(handler->selector);
+            llvm::SwitchInst* sw = llvm::SwitchInst::Create(sel, endbb, handler->exits.size(), p->scopebb());
+            for (size_t i = 0; i < handler->exits.size(); i++)
+                sw->addCase(DtoConstUint(i + 1), handler->exits[i]);
+        }
     }
 
     // rewrite the scope
@@ -1185,7 +1247,17 @@ void ForeachStatement::toIR(IRState* p)
     }
 
     // what to iterate
-    DValue* aggrval = aggr->toElemDtor(p);
+    DValue* aggrval = NULL;
+    // iterating by value only reads the elements, so a dynamic array literal
+    // of constants needn't be copied at all
+    if (valvar && aggr->op == TOKarrayliteral && aggr->type->toBasetype()->ty == Tarray)
+    {
+        ArrayLiteralExp* ale = (ArrayLiteralExp*)aggr;
+        if (LLConstant* store = DtoArrayLiteralStorage(ale))
+            aggrval = new DSliceValue(aggr->type, DtoConstSize_t(ale->elements->dim), store);
+    }
+    if (!aggrval)
+        aggrval = aggr->toElemDtor(p);
 
     // get length and pointer
     LLValue* niters = DtoArrayLen(aggrval);
@@ -1521,7 +1593,8 @@ void WithStatement::toIR(IRState* p)
 
 static LLConstant* generate_unique_critical_section()
 {
-    LLType* Mty = DtoMutexType();
+    // a thin lock is never seen by the runtime, so it only needs its own layout
+    LLType* Mty = DtoUseThinLocks() ? DtoThinLockType() : DtoMutexType();
     return new llvm::GlobalVariable(*gIR->module, Mty, false, llvm::GlobalValue::InternalLinkage, LLConstant::getNullValue(Mty), ".uniqueCS");
 }
 
@@ -1542,7 +1615,7 @@ void SynchronizedStatement::toIR(IRState* p)
     else
     {
         llsync = generate_unique_critical_section();
-        DtoEnterCritical(llsync);
+        DtoEnterCritical(loc, llsync);
     }
 
     // emit body
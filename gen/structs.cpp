@@ -93,22 +93,148 @@ void DtoResolveStruct(StructDeclaration* sd)
 ////////////////////////////   D STRUCT UTILITIES     ////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////
 
+typedef std::pair<unsigned, unsigned> ByteRange;
+
+// Collects the byte ranges occupied by the fields of sd, recursing into
+// nested structs so their padding is left out as well.
+static void addFieldRanges(StructDeclaration* sd, unsigned base, std::vector<ByteRange>& ranges)
+{
+    ArrayIter<VarDeclaration> it(sd->fields);
+    for (; !it.done(); it.next())
+    {
+        VarDeclaration* vd = it.get();
+        Type* ft = vd->type->toBasetype();
+        unsigned offset = base + vd->offset;
+
+        if (ft->ty == Tstruct)
+        {
+            addFieldRanges(static_cast<TypeStruct*>(ft)->sym, offset, ranges);
+            continue;
+        }
+        if (ft->ty == Tsarray)
+        {
+            Type* et = ft->nextOf()->toBasetype();
+            uinteger_t dim = static_cast<TypeSArray*>(ft)->dim->toInteger();
+            if (et->ty == Tstruct && dim <= 16)
+            {
+                unsigned esize = et->size();
+                for (unsigned i = 0; i < dim; i++)
+                    addFieldRanges(static_cast<TypeStruct*>(et)->sym, offset + i * esize, ranges);
+                continue;
+            }
+        }
+
+        unsigned size = ft->size();
+        if (size)
+            ranges.push_back(ByteRange(offset, offset + size));
+    }
+}
+
+// Runs longer than this are compared with memcmp.
+static const unsigned inlineCompareLimit = 64;
+
 LLValue* DtoStructEquals(TOK op, DValue* lhs, DValue* rhs)
 {
     Type* t = lhs->getType()->toBasetype();
     assert(t->ty == Tstruct);
 
-    // set predicate
-    llvm::ICmpInst::Predicate cmpop;
+    Logger::println("DtoStructEquals: %s", t->toChars());
+    LOG_SCOPE;
+
+    // The comparison is bitwise, like the memcmp it replaces, but ignores the
+    // padding between fields. Contiguous fields (and overlapping union
+    // members) are merged into runs.
+    std::vector<ByteRange> ranges;
+    addFieldRanges(static_cast<TypeStruct*>(t)->sym, 0, ranges);
+    std::sort(ranges.begin(), ranges.end());
+
+    std::vector<ByteRange> runs;
+    for (std::vector<ByteRange>::iterator I = ranges.begin(), E = ranges.end(); I != E; ++I)
+    {
+        if (!runs.empty() && I->first <= runs.back().second)
+            runs.back().second = std::max(runs.back().second, I->second);
+        else
+            runs.push_back(*I);
+    }
+
+    LLType* voidPtrTy = getVoidPtrType();
+    LLValue* lptr = DtoBitCast(lhs->getRVal(), voidPtrTy);
+    LLValue* rptr = DtoBitCast(rhs->getRVal(), voidPtrTy);
+    unsigned structAlign = getABITypeAlign(DtoType(t));
+
+    LLType* i64 = LLType::getInt64Ty(gIR->context());
+    LLType* v2i64 = llvm::VectorType::get(i64, 2);
+
+    // xor of the inline chunks, or'ed together; 16 byte chunks are kept in
+    // a vector so the backend can use SIMD registers for them
+    LLValue* acc = NULL;
+    LLValue* vacc = NULL;
+    // i1 "differs" of the memcmp'ed runs
+    LLValue* differs = NULL;
+
+    for (std::vector<ByteRange>::iterator I = runs.begin(), E = runs.end(); I != E; ++I)
+    {
+        unsigned start = I->first, len = I->second - I->first;
+        IF_LOG Logger::println("run [%u, %u)", I->first, I->second);
+
+        if (len > inlineCompareLimit)
+        {
+            LLValue* val = DtoMemCmp(DtoGEPi1(lptr, start), DtoGEPi1(rptr, start), DtoConstSize_t(len));
+            LLValue* ne = gIR->ir->CreateICmpNE(val, LLConstantInt::get(val->getType(), 0, false), "tmp");
+            differs = differs ? gIR->ir->CreateOr(differs, ne, "tmp") : ne;
+            continue;
+        }
+
+        for (unsigned off = start; off < I->second; )
+        {
+            unsigned width = 16;
+            while (width > I->second - off)
+                width >>= 1;
+            unsigned align = std::min(width, structAlign);
+            while (off % align)
+                align >>= 1;
+
+            LLType* ty = width == 16 ? v2i64 : LLType::getIntNTy(gIR->context(), width * 8);
+            llvm::LoadInst* l = gIR->ir->CreateLoad(DtoBitCast(DtoGEPi1(lptr, off), getPtrToType(ty)), "tmp");
+            llvm::LoadInst* r = gIR->ir->CreateLoad(DtoBitCast(DtoGEPi1(rptr, off), getPtrToType(ty)), "tmp");
+            l->setAlignment(align);
+            r->setAlignment(align);
+            LLValue* x = gIR->ir->CreateXor(l, r, "tmp");
+
+            if (width == 16)
+            {
+                vacc = vacc ? gIR->ir->CreateOr(vacc, x, "tmp") : x;
+            }
+            else
+            {
+                if (width < 8)
+                    x = gIR->ir->CreateZExt(x, i64, "tmp");
+                acc = acc ? gIR->ir->CreateOr(acc, x, "tmp") : x;
+            }
+            off += width;
+        }
+    }
+
+    if (vacc)
+    {
+        LLType* i128 = LLType::getIntNTy(gIR->context(), 128);
+        LLValue* ne = gIR->ir->CreateICmpNE(gIR->ir->CreateBitCast(vacc, i128, "tmp"),
+            LLConstantInt::get(i128, 0, false), "tmp");
+        differs = differs ? gIR->ir->CreateOr(differs, ne, "tmp") : ne;
+    }
+    if (acc)
+    {
+        LLValue* ne = gIR->ir->CreateICmpNE(acc, LLConstantInt::get(i64, 0, false), "tmp");
+        differs = differs ? gIR->ir->CreateOr(differs, ne, "tmp") : ne;
+    }
+
+    // no fields: all instances are equal
+    if (!differs)
+        differs = LLConstantInt::getFalse(gIR->context());
+
     if (op == TOKequal || op == TOKidentity)
-        cmpop = llvm::ICmpInst::ICMP_EQ;
-    else
-        cmpop = llvm::ICmpInst::ICMP_NE;
-
-    // call memcmp
-    size_t sz = getTypePaddedSize(DtoType(t));
-    LLValue* val = DtoMemCmp(lhs->getRVal(), rhs->getRVal(), DtoConstSize_t(sz));
-    return gIR->ir->CreateICmp(cmpop, val, LLConstantInt::get(val->getType(), 0, false), "tmp");
+        return gIR->ir->CreateNot(differs, "tmp");
+    return differs;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -685,3 +685,77 @@ DValue* DtoCallFunction(Loc& loc, Type* resulttype, DValue* fnval, Expressions*
 
     return new DImValue(resulttype, retllval);
 }
+
+//////////////////////////////////////////////////////////////////////////////////////////
+
+bool DtoIsApplyDelegate(Type* dgtype, size_t nparams)
+{
+    Type* tb = dgtype->toBasetype();
+    if (tb->ty != Tdelegate)
+        return false;
+
+    TypeFunction* tf = (TypeFunction*)tb->nextOf();
+    if (tf->varargs || tf->linkage != LINKd || tf->next->toBasetype()->ty != Tint32)
+        return false;
+    if (Parameter::dim(tf->parameters) != nparams)
+        return false;
+    for (size_t i = 0; i < nparams; i++)
+    {
+        Parameter* p = Parameter::getNth(tf->parameters, i);
+        if (!(p->storageClass & STCref) && p->type->toBasetype()->ty != Tpointer)
+            return false;
+    }
+    return true;
+}
+
+LLValue* DtoCallApplyDelegate(Loc& loc, Type* dgtype, LLValue* dg, const std::vector<LLValue*>& ptrs)
+{
+    assert(DtoIsApplyDelegate(dgtype, ptrs.size()));
+    TypeFunction* tf = (TypeFunction*)dgtype->toBasetype()->nextOf();
+
+    // make sure the function type has been processed
+    DtoType(dgtype);
+    assert(!tf->fty.arg_sret);
+
+    LLValue* funcptr = gIR->ir->CreateExtractValue(dg, 1, ".funcptr");
+    LLFunctionType* fty = DtoExtractFunctionType(funcptr->getType());
+    assert(fty->getNumParams() == ptrs.size() + 1);
+
+    std::vector<llvm::AttributeWithIndex> attrs;
+    llvm::AttributeWithIndex Attr;
+    if (tf->fty.ret->attrs)
+    {
+        Attr.Index = 0;
+        Attr.Attrs = tf->fty.ret->attrs;
+        attrs.push_back(Attr);
+    }
+
+    // context first, then the formal parameters in ABI order
+    std::vector<LLValue*> args;
+    args.push_back(DtoBitCast(gIR->ir->CreateExtractValue(dg, 0, ".ptr"), fty->getParamType(0)));
+    IrFuncTyArg* ctxarg = tf->fty.arg_this ? tf->fty.arg_this : tf->fty.arg_nest;
+    if (ctxarg && ctxarg->attrs)
+    {
+        Attr.Index = 1;
+        Attr.Attrs = ctxarg->attrs;
+        attrs.push_back(Attr);
+    }
+
+    size_t n = ptrs.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t j = tf->fty.reverseParams ? n - i - 1 : i;
+        args.push_back(DtoBitCast(ptrs[j], fty->getParamType(i + 1)));
+        if (tf->fty.args[j]->attrs)
+        {
+            Attr.Index = i + 2;
+            Attr.Attrs = tf->fty.args[j]->attrs;
+            attrs.push_back(Attr);
+        }
+    }
+
+    LLCallSite call = gIR->CreateCallOrInvoke(funcptr, args, "tmp");
+    call.setCallingConv(DtoCallingConv(loc, tf->linkage));
+    call.setAttributes(llvm::AttrListPtr::get(attrs.begin(), attrs.end()));
+    return call.getInstruction();
+}
@@ -15,11 +15,19 @@
 #include "gen/llvmhelpers.h"
 #include "gen/linkage.h"
 #include "gen/utils.h"
+#include "gen/optimizer.h"
 
 #include "ir/irmodule.h"
 
+#include "llvm/Support/CommandLine.h"
+
 using namespace llvm::dwarf;
 
+static llvm::cl::opt<bool> limitDebugInfo("limit-debug-info",
+    llvm::cl::desc("Describe structs and classes in full only in the debug info "
+                   "of the module that defines them"),
+    llvm::cl::ZeroOrMore);
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 // get the module the symbol is in, or - for template instances - the current module
@@ -215,17 +223,57 @@ static llvm::DIType dwarfCompositeType(Type* type)
     if (sd->sizeok == 0)
         return llvm::DICompositeType(NULL);
 
+#if DMDV2
+    // const, immutable and shared variants are qualified references to the
+    // description of the plain aggregate
+    if (t->mod)
+    {
+        IRState::DITypeMap::iterator it = gIR->diTypes.find(t);
+        if (it != gIR->diTypes.end())
+            return it->second;
+
+        llvm::DIType ret = dwarfCompositeType(sd->getType());
+        if ((llvm::MDNode*)ret == 0)
+            return ret;
+        if (t->isShared())
+            ret = gIR->dibuilder.createQualifiedType(DW_TAG_volatile_type, ret);
+        if (t->isConst() || t->isImmutable() || t->isWild())
+            ret = gIR->dibuilder.createQualifiedType(DW_TAG_const_type, ret);
+        gIR->diTypes[t] = ret;
+        return ret;
+    }
+#endif
+
     IrStruct* ir = sd->ir.irStruct;
     assert(ir);
-    if ((llvm::MDNode*)ir->diCompositeType != 0)
-        return ir->diCompositeType;
+    Type* key = sd->getType();
+    IRState::DITypeMap::iterator it = gIR->diTypes.find(key);
+    if (it != gIR->diTypes.end())
+        return it->second;
 
     name = sd->toChars();
     linnum = sd->loc.linnum;
     file = DtoDwarfFile(sd->loc);
-    // set diCompositeType to handle recursive types properly
-    if (!ir->diCompositeType)
-        ir->diCompositeType = gIR->dibuilder.createTemporaryType();
+
+    // Other modules only get a declaration; debuggers look the members up
+    // in the module that defines the aggregate.
+    if (limitDebugInfo && getDefinedModule(sd) != gIR->dmodule)
+    {
+        llvm::DIArray noElems = gIR->dibuilder.getOrCreateArray(std::vector<llvm::Value*>());
+        llvm::DIType decl;
+        if (t->ty == Tclass)
+            decl = gIR->dibuilder.createClassType(llvm::DIDescriptor(file), name, file, linnum,
+                0, 0, 0, llvm::DIType::FlagFwdDecl, llvm::DIType(NULL), noElems);
+        else
+            decl = gIR->dibuilder.createStructType(llvm::DIDescriptor(file), name, file, linnum,
+                0, 0, llvm::DIType::FlagFwdDecl, noElems);
+        gIR->diTypes[key] = decl;
+        return decl;
+    }
+
+    // register a placeholder to handle recursive types properly
+    llvm::DIType placeholder = gIR->dibuilder.createTemporaryType();
+    gIR->diTypes[key] = placeholder;
 
     if (!ir->aggrdecl->isInterfaceDeclaration()) // plain interfaces don't have one
     {
@@ -262,7 +310,7 @@ static llvm::DIType dwarfCompositeType(Type* type)
            getTypeBitSize(T), // size in bits
            getABITypeAlign(T)*8, // alignment in bits
            0, // offset in bits,
-           llvm::DIType::FlagFwdDecl, // flags
+           0, // flags
            derivedFrom, // DerivedFrom
            elemsArray
         );
@@ -274,13 +322,13 @@ static llvm::DIType dwarfCompositeType(Type* type)
            linnum, // line number where defined
            getTypeBitSize(T), // size in bits
            getABITypeAlign(T)*8, // alignment in bits
-           llvm::DIType::FlagFwdDecl, // flags
+           0, // flags
            elemsArray
         );
     }
 
-    ir->diCompositeType.replaceAllUsesWith(ret);
-    ir->diCompositeType = ret;
+    placeholder.replaceAllUsesWith(ret);
+    gIR->diTypes[key] = ret;
 
     return ret;
 }
@@ -310,7 +358,14 @@ static llvm::DIGlobalVariable dwarfGlobalVariable(LLGlobalVariable* ll, VarDecla
 
 static void dwarfDeclare(LLValue* var, llvm::DIVariable divar)
 {
-    llvm::Instruction *instr = gIR->dibuilder.insertDeclare(var, divar, gIR->scopebb());
+    // Declare stack slots next to the allocas: a declaration in a block the
+    // optimizer merges or removes would take the variable with it.
+    llvm::Instruction *instr;
+    llvm::AllocaInst *alloca = llvm::dyn_cast<llvm::AllocaInst>(var);
+    if (alloca && alloca->getParent() == gIR->topallocapoint()->getParent())
+        instr = gIR->dibuilder.insertDeclare(var, divar, gIR->topallocapoint());
+    else
+        instr = gIR->dibuilder.insertDeclare(var, divar, gIR->scopebb());
     instr->setDebugLoc(gIR->ir->getCurrentDebugLocation());
 }
 
@@ -348,16 +403,26 @@ static llvm::DIType dwarfTypeDescription_impl(Type* type, const char* c_name)
     Type* t = type->toBasetype();
     if (t->ty == Tvoid)
         return llvm::DIType(NULL);
-    else if (t->isintegral() || t->isfloating())
-        return dwarfBasicType(type);
-    else if (t->ty == Tpointer)
-        return dwarfPointerType(type);
-    else if (t->ty == Tarray)
-        return dwarfArrayType(type);
+    // aggregates maintain the cache themselves, see dwarfCompositeType
     else if (t->ty == Tstruct || t->ty == Tclass)
         return dwarfCompositeType(type);
 
-    return llvm::DIType(NULL);
+    IRState::DITypeMap::iterator it = gIR->diTypes.find(type);
+    if (it != gIR->diTypes.end())
+        return it->second;
+
+    llvm::DIType ret;
+    if (t->isintegral() || t->isfloating())
+        ret = dwarfBasicType(type);
+    else if (t->ty == Tpointer)
+        ret = dwarfPointerType(type);
+    else if (t->ty == Tarray)
+        ret = dwarfArrayType(type);
+    else
+        return llvm::DIType(NULL);
+
+    gIR->diTypes[type] = ret;
+    return ret;
 }
 
 static llvm::DIType dwarfTypeDescription(Type* type, const char* c_name)
@@ -451,7 +516,7 @@ void DtoDwarfCompileUnit(Module* m)
         srcname,
         srcpath,
         "LDC (https://github.com/ldc-developers/ldc)",
-        false, // isOptimized TODO
+        optimize(), // isOptimized
         llvm::StringRef(), // Flags TODO
         1 // Runtime Version TODO
     );
@@ -481,7 +546,7 @@ llvm::DISubprogram DtoDwarfSubProgram(FuncDeclaration* fd)
         fd->protection == PROTprivate, // is local to unit
         gIR->dmodule == getDefinedModule(fd), // isdefinition
         0, // Flags
-        false, // isOptimized
+        optimize(), // isOptimized
         fd->ir.irFunc->func
     );
 }
@@ -585,6 +650,12 @@ void DtoDwarfBlockEnd()
     IrFunction *fn = gIR->func();
     assert(!fn->diLexicalBlocks.empty());
     fn->diLexicalBlocks.pop();
+
+    // code following the block belongs to the enclosing scope, even before
+    // the next stop point
+    llvm::DebugLoc loc = gIR->ir->getCurrentDebugLocation();
+    if (!loc.isUnknown())
+        gIR->ir->SetCurrentDebugLocation(llvm::DebugLoc::get(loc.getLine(), loc.getCol(), getCurrentScope()));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -602,17 +673,6 @@ void DtoDwarfStopPoint(unsigned ln)
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
-void DtoDwarfValue(LLValue *val, VarDeclaration* vd)
-{
-    if (!global.params.symdebug || !vd->debugVariable)
-        return;
-
-    llvm::Instruction *instr = gIR->dibuilder.insertDbgValueIntrinsic(val, 0, vd->debugVariable, gIR->scopebb());
-    instr->setDebugLoc(gIR->ir->getCurrentDebugLocation());
-}
-
-//////////////////////////////////////////////////////////////////////////////////////////////////
-
 void DtoDwarfModuleEnd()
 {
     if (!global.params.symdebug)
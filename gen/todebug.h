@@ -34,8 +34,6 @@ void DtoDwarfBlockEnd();
 
 void DtoDwarfStopPoint(unsigned ln);
 
-void DtoDwarfValue(LLValue *val, VarDeclaration* vd);
-
 /**
  * Emits all things necessary for making debug info for a local variable vd.
  * @param ll LLVM Value of the variable.
@@ -890,6 +890,28 @@ DValue* CallExp::toElem(IRState* p)
             }
         }
 
+        // foreach over a string with decoding
+        if (fndecl->linkage == LINKc && fndecl->ident && !strncmp(fndecl->ident->string, "_aApply", 7))
+        {
+            if (DValue* res = DtoApplyUtf(loc, fndecl, arguments))
+                return res;
+        }
+#if DMDV2
+        // foreach over an associative array
+        if (fndecl->linkage == LINKc && fndecl->ident && !strncmp(fndecl->ident->string, "_aaApply", 8))
+        {
+            if (DValue* res = DtoAAApply(loc, fndecl, arguments))
+                return res;
+        }
+        // a bare synchronized {}
+        if (fndecl->linkage == LINKc &&
+            (fndecl->ident == Id::criticalenter || fndecl->ident == Id::criticalexit))
+        {
+            if (DtoCriticalSectionCall(loc, fndecl, arguments))
+                return NULL;
+        }
+#endif
+
         // va_start instruction
         if (fndecl->llvmInternal == LLVMva_start) {
             if (arguments->dim != 2) {
@@ -1947,7 +1969,7 @@ DValue* NewExp::toElem(IRState* p)
 #endif
         {
             // default allocator
-            mem = DtoNew(newtype);
+            mem = DtoNew(loc, newtype);
         }
         // init
         TypeStruct* ts = (TypeStruct*)ntype;
@@ -1979,7 +2001,7 @@ DValue* NewExp::toElem(IRState* p)
     else
     {
         // allocate
-        LLValue* mem = DtoNew(newtype);
+        LLValue* mem = DtoNew(loc, newtype);
         DVarValue tmpvar(newtype, mem);
 
         // default initialize
@@ -2560,23 +2582,7 @@ DValue* CatExp::toElem(IRState* p)
     Logger::print("CatExp::toElem: %s @ %s\n", toChars(), type->toChars());
     LOG_SCOPE;
 
-#if DMDV2
     return DtoCatArrays(type, e1, e2);
-#else
-
-    bool arrNarr = e1->type->toBasetype() == e2->type->toBasetype();
-    // array ~ array
-    if (arrNarr)
-    {
-        return DtoCatArrays(type, e1, e2);
-    }
-    // array ~ element
-    // element ~ array
-    else
-    {
-        return DtoCatArrayElement(type, e1, e2);
-    }
-#endif
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -2730,6 +2736,29 @@ DValue* ArrayLiteralExp::toElem(IRState* p)
         return new DSliceValue(type, DtoConstSize_t(0), getNullPtr(getPtrToType(llElemType)));
     }
 
+    // literals of constants are copied from a read-only global at once
+    if (LLConstant* constStore = DtoArrayLiteralStorage(this))
+    {
+        LLValue* size = DtoConstSize_t(getTypePaddedSize(llStoType));
+        if (!dyn)
+        {
+            LLValue* dstMem = DtoRawAlloca(llStoType, 0, "arrayliteral");
+            DtoMemCpy(dstMem, constStore, size);
+            return new DImValue(type, dstMem);
+        }
+
+#if DMDV2
+        // nobody can tell immutable data from a fresh copy
+        if (arrayType->nextOf()->isImmutable())
+            return new DSliceValue(type, DtoConstSize_t(len), constStore);
+#endif
+
+        // the GC2Stack pass moves this to the stack if it doesn't escape
+        DSliceValue* dynSlice = DtoNewDynArray(loc, arrayType, new DConstValue(Type::tsize_t, DtoConstSize_t(len)), false);
+        DtoMemCpy(dynSlice->ptr, constStore, size);
+        return dynSlice;
+    }
+
     // dst pointer
     LLValue* dstMem;
     DSliceValue* dynSlice = NULL;
@@ -39,6 +39,7 @@
 #include "scope.h"
 
 #include "gen/abi.h"
+#include "gen/archive.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
 #include "gen/cl_options.h"
@@ -71,11 +72,29 @@ static llvm::cl::opt<bool> noVerify("noverify",
 //////////////////////////////////////////////////////////////////////////////////////////
 
 // fwd decl
-void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_fd_ostream& Out,
+void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_ostream& Out,
                llvm::TargetMachine::CodeGenFileType fileType);
 
 //////////////////////////////////////////////////////////////////////////////////////////
 
+// Reports the TypeInfos semantic requested for m that no code referred to.
+static void countElidedTypeInfos(Module* m)
+{
+    unsigned total = 0, elided = 0;
+    for (unsigned k=0; k < m->members->dim; k++) {
+        TypeInfoDeclaration* tid = ((Dsymbol*)m->members->data[k])->isTypeInfoDeclaration();
+        if (!tid || tid->tinfo->builtinTypeInfo())
+            continue;
+        total++;
+        if (!tid->ir.resolved)
+            elided++;
+    }
+
+    Logger::println("%u of %u TypeInfos elided", elided, total);
+    if (global.params.verbose)
+        printf("typeinfo  %u of %u elided\n", elided, total);
+}
+
 llvm::Module* Module::genLLVMModule(llvm::LLVMContext& context, Ir* sir)
 {
     bool logenabled = Logger::enabled();
@@ -138,6 +157,10 @@ llvm::Module* Module::genLLVMModule(llvm::LLVMContext& context, Ir* sir)
     for (unsigned k=0; k < members->dim; k++) {
         Dsymbol* dsym = (Dsymbol*)(members->data[k]);
         assert(dsym);
+        // semantic adds every TypeInfo it asks for to the module, with
+        // -lazy-typeinfo they are only emitted once code refers to them
+        if (opts::lazyTypeInfo && dsym->isTypeInfoDeclaration())
+            continue;
         dsym->codegen(sir);
     }
 
@@ -165,6 +188,9 @@ llvm::Module* Module::genLLVMModule(llvm::LLVMContext& context, Ir* sir)
     // generate ModuleInfo
     genmoduleinfo();
 
+    if (opts::lazyTypeInfo)
+        countElidedTypeInfos(this);
+
     // verify the llvm
     if (!noVerify) {
         std::string verifyErr;
@@ -192,7 +218,7 @@ llvm::Module* Module::genLLVMModule(llvm::LLVMContext& context, Ir* sir)
     return ir.module;
 }
 
-void writeModule(llvm::Module* m, std::string filename)
+void writeModule(llvm::Module* m, std::string filename, ArchiveMember* member)
 {
     // run optimizer
     bool reverify = ldc_optimize_module(m);
@@ -268,7 +294,21 @@ void writeModule(llvm::Module* m, std::string filename)
         }
     }
 
-    if (global.params.output_o) {
+    // keep the object in memory, it goes straight into a static library
+    if (global.params.output_o && member) {
+        Logger::println("Writing object file %s to memory\n", filename.c_str());
+        {
+            llvm::raw_svector_ostream out(member->data);
+            emit_file(*gTargetMachine, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
+        }
+        std::string err;
+        if (!collectArchiveSymbols(*member, err))
+        {
+            error("cannot read symbols of %s: %s", filename.c_str(), err.c_str());
+            fatal();
+        }
+    }
+    else if (global.params.output_o) {
         LLPath objpath = LLPath(filename);
         Logger::println("Writing object file to: %s\n", objpath.c_str());
         std::string err;
@@ -290,7 +330,7 @@ void writeModule(llvm::Module* m, std::string filename)
 /* ================================================================== */
 
 // based on llc code, University of Illinois Open Source License
-void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_fd_ostream& out,
+void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_ostream& out,
                llvm::TargetMachine::CodeGenFileType fileType)
 {
     using namespace llvm;
@@ -304,9 +344,8 @@ void emit_file(llvm::TargetMachine &Target, llvm::Module& m, llvm::raw_fd_ostrea
         Passes.add(new TargetData(&m));
 
     // Last argument is enum CodeGenOpt::Level OptLevel
-    // debug info doesn't work properly with OptLevel != None!
     CodeGenOpt::Level LastArg = CodeGenOpt::Default;
-    if (global.params.symdebug || !optimize())
+    if (!optimize())
         LastArg = CodeGenOpt::None;
     else if (optLevel() >= 3)
         LastArg = CodeGenOpt::Aggressive;
@@ -825,7 +864,10 @@ void Module::genmoduleinfo()
     // build the modulereference and ctor for registering it
     LLFunction* mictor = build_module_reference_and_ctor(moduleInfoSymbol());
 
-    // register this ctor in the magic llvm.global_ctors appending array
+    // register this ctor in the magic llvm.global_ctors appending array.
+    // Linkers always keep the .ctors/.init_array entries, so the ctor keeps
+    // the ModuleReference and thereby the ModuleInfo alive when linking with
+    // --gc-sections.
     LLFunctionType* magicfty = LLFunctionType::get(LLType::getVoidTy(gIR->context()), std::vector<LLType*>(), false);
     std::vector<LLType*> magictypes;
     magictypes.push_back(LLType::getInt32Ty(gIR->context()));
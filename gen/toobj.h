@@ -1,6 +1,13 @@
 #ifndef LDC_GEN_TOOBJ_H
 #define LDC_GEN_TOOBJ_H
 
-void writeModule(llvm::Module* m, std::string filename);
+struct ArchiveMember;
+
+/**
+ * Optimizes m and writes the requested output files for it.
+ * If member is given, the object file is emitted into member instead of
+ * being written to disk.
+ */
+void writeModule(llvm::Module* m, std::string filename, ArchiveMember* member = 0);
 
 #endif
@@ -11,6 +11,7 @@
 
 struct Statement;
 struct EnclosingHandler;
+struct VarDeclaration;
 
 // scope statements that can be target of jumps
 // includes loops, switch, case, labels
@@ -55,6 +56,10 @@ struct FuncGen
     IRLandingPad landingPadInfo;
     llvm::BasicBlock* landingPad;
 
+    // capacity caches of slices appended to in loops, see DtoCatAssignElement
+    typedef std::map<VarDeclaration*, llvm::Value*> AppendCacheMap;
+    AppendCacheMap appendCaches;
+
 private:
     // prefix for labels and gotos
     // used for allowing labels to be emitted twice
@@ -31,9 +31,6 @@ struct IrStruct : IrBase
     /// true only for: align(1) struct S { ... } 
     bool packed;
 
-    /// Composite type debug description.
-    llvm::DIType diCompositeType;
-
     //////////////////////////////////////////////////////////////////////////
 
     /// Create the __initZ symbol lazily.
@@ -0,0 +1,37 @@
+/**
+ * In-process collector for binaries compiled with ldc's -alloc-profile.
+ *
+ * Every instrumented allocation site owns a static Site descriptor emitted
+ * by the compiler (see DtoAllocProfile in gen/llvmhelpers.cpp) and calls
+ * _d_allocprof_hit right after the GC hook returns. Appends only allocate
+ * when the array moves to a new block; then they call _d_allocprof_block,
+ * which counts the size of that block. On exit the sites are dumped,
+ * largest byte count first, to stderr or to the file named by the
+ * LDC_ALLOCPROF environment variable.
+ */
+
+#include <stddef.h>
+
+#include "../sitestats/sitestats.h"
+
+static SiteTable allocSites = { "LDC_ALLOCPROF", "bytes", "count" };
+
+void _d_allocprof_hit(Site* site, size_t nbytes)
+{
+    _d_sitestats_hit(&allocSites, site, nbytes);
+}
+
+/* core.memory.BlkInfo, as returned by gc_query */
+typedef struct BlkInfo
+{
+    void* base;
+    size_t size;
+    unsigned attr;
+} BlkInfo;
+
+BlkInfo gc_query(void* p);
+
+void _d_allocprof_block(Site* site, void* p)
+{
+    _d_sitestats_hit(&allocSites, site, gc_query(p).size);
+}
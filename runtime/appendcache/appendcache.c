@@ -0,0 +1,89 @@
+/**
+ * Fills the append caches of binaries compiled with ldc's -inline-appends.
+ *
+ * The compiler keeps an AppendCache for every slice that is appended to in
+ * a loop (see DtoAppendCache in gen/arrays.cpp). After an append that went
+ * through _d_arrayappendcTX or _d_arrayappendT it passes the new array to
+ * _d_appendcache_fill, which describes the GC block holding it. The inline
+ * fast path then compares the used length the runtime keeps in the block
+ * with the end of the array and bumps it, like rt/lifetime.d does, while
+ * the block has room.
+ *
+ * This is the only place that knows how rt/lifetime.d lays out appendable
+ * blocks. Blocks it does not recognize get a width of 0, which sends every
+ * append through the runtime.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* core.memory.BlkInfo, as returned by gc_query */
+typedef struct BlkInfo
+{
+    void* base;
+    size_t size;
+    unsigned attr;
+} BlkInfo;
+
+BlkInfo gc_query(void* p);
+
+/* Must match DtoAppendCache. */
+typedef struct AppendCache
+{
+    void* ptr;      /* array the cache describes */
+    void* used;     /* used length field of its block */
+    size_t width;   /* size of that field, 0 to always call the runtime */
+    size_t start;   /* offset of ptr from the start of the block's data */
+    size_t limit;   /* largest used length the block can hold */
+} AppendCache;
+
+/* From rt/lifetime.d */
+enum
+{
+    APPENDABLE = 0x8,   /* BlkAttr.APPENDABLE */
+    PAGESIZE = 4096,
+    SMALLSIZE = 256,    /* up to here the used length is a ubyte at the end */
+    MEDPAD = 2,         /* below a page it is a ushort at the end */
+    LARGEPREFIX = 16,   /* otherwise a size_t in front of the data */
+    LARGEPAD = LARGEPREFIX + 1
+};
+
+void _d_appendcache_fill(void* ptr, AppendCache* cache)
+{
+    BlkInfo info = gc_query(ptr);
+    char* data = (char*)info.base;
+    size_t size = info.size;
+
+    cache->ptr = ptr;
+    cache->width = 0;
+
+    if (!info.base || !(info.attr & APPENDABLE))
+        return;
+
+    if (size >= 16 && size <= SMALLSIZE && (size & (size - 1)) == 0)
+    {
+        cache->width = 1;
+        cache->used = data + size - 1;
+        cache->limit = size - 1;
+    }
+    else if (size > SMALLSIZE && size < PAGESIZE && (size & (size - 1)) == 0)
+    {
+        cache->width = MEDPAD;
+        cache->used = data + size - MEDPAD;
+        cache->limit = size - MEDPAD;
+    }
+    else if (size >= PAGESIZE && size % PAGESIZE == 0)
+    {
+        cache->width = sizeof(size_t);
+        cache->used = data;
+        data += LARGEPREFIX;
+        cache->limit = size - LARGEPAD;
+    }
+    else
+        return;
+
+    if ((char*)ptr < data || (size_t)((char*)ptr - data) > cache->limit)
+        cache->width = 0;
+    else
+        cache->start = (char*)ptr - data;
+}
@@ -0,0 +1,107 @@
+/**
+ * Per-site statistics shared by the -alloc-profile and -thin-lock-stats
+ * collectors, see sitestats.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "sitestats.h"
+
+static SiteTable* tables = NULL;
+static volatile uint32_t dumpRegistered = 0;
+
+static int compareSites(const void* a, const void* b)
+{
+    const Site* x = *(const Site* const*)a;
+    const Site* y = *(const Site* const*)b;
+    if (x->total != y->total)
+        return x->total < y->total ? 1 : -1;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return 0;
+}
+
+static void dumpTable(SiteTable* table)
+{
+    size_t n = 0, i;
+    Site* s;
+    Site** sorted;
+    FILE* out = stderr;
+    const char* fname = getenv(table->envvar);
+
+    for (s = table->sites; s; s = s->next)
+        n++;
+    if (!n)
+        return;
+
+    sorted = (Site**)malloc(n * sizeof(Site*));
+    if (!sorted)
+        return;
+    for (i = 0, s = table->sites; s; s = s->next)
+        sorted[i++] = s;
+    qsort(sorted, n, sizeof(Site*), compareSites);
+
+    if (fname && *fname)
+    {
+        out = fopen(fname, "w");
+        if (!out)
+            out = stderr;
+    }
+
+    fprintf(out, "%16s %12s  %s\n", table->totalName, table->countName, "site");
+    for (i = 0; i < n; i++)
+    {
+        s = sorted[i];
+        fprintf(out, "%16llu %12llu  %s:%u%s%s\n",
+            (unsigned long long)s->total, (unsigned long long)s->count,
+            s->file, s->line, s->what ? " " : "", s->what ? s->what : "");
+    }
+
+    if (out != stderr)
+        fclose(out);
+    free(sorted);
+}
+
+static void dumpTables(void)
+{
+    SiteTable* t;
+    for (t = tables; t; t = t->next)
+        dumpTable(t);
+}
+
+static void registerTable(SiteTable* table)
+{
+    SiteTable* head;
+    do
+    {
+        head = tables;
+        table->next = head;
+    } while (!__sync_bool_compare_and_swap(&tables, head, table));
+
+    if (!dumpRegistered && __sync_bool_compare_and_swap(&dumpRegistered, 0, 1))
+        atexit(dumpTables);
+}
+
+static void registerSite(SiteTable* table, Site* site)
+{
+    Site* head;
+    do
+    {
+        head = table->sites;
+        site->next = head;
+    } while (!__sync_bool_compare_and_swap(&table->sites, head, site));
+
+    if (!table->registered && __sync_bool_compare_and_swap(&table->registered, 0, 1))
+        registerTable(table);
+}
+
+void _d_sitestats_hit(SiteTable* table, Site* site, uint64_t total)
+{
+    if (!site->registered && __sync_bool_compare_and_swap(&site->registered, 0, 1))
+        registerSite(table, site);
+
+    __sync_fetch_and_add(&site->count, 1);
+    __sync_fetch_and_add(&site->total, total);
+}
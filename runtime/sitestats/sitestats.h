@@ -0,0 +1,42 @@
+/**
+ * Per-site statistics shared by the -alloc-profile and -thin-lock-stats
+ * collectors.
+ *
+ * The compiler emits a static, writable Site descriptor for every
+ * instrumented site (see DtoSiteDescriptor in gen/llvmhelpers.cpp). The
+ * first hit links it into the list of its SiteTable; on exit every table
+ * that saw a hit is dumped, largest total first, to stderr or to the file
+ * named by the table's environment variable.
+ */
+
+#ifndef LDC_SITESTATS_H
+#define LDC_SITESTATS_H
+
+#include <stdint.h>
+
+/* Must match the layout built in DtoSiteDescriptor. */
+typedef struct Site
+{
+    struct Site* next;
+    const char* file;
+    const char* what;       /* printed after the location, may be NULL */
+    uint32_t line;
+    uint32_t registered;
+    uint64_t count;
+    uint64_t total;
+} Site;
+
+typedef struct SiteTable
+{
+    const char* envvar;     /* names the file to dump to */
+    const char* totalName;  /* column headers */
+    const char* countName;
+    Site* sites;
+    uint32_t registered;
+    struct SiteTable* next;
+} SiteTable;
+
+/* Counts one event of weight total at site. Thread safe. */
+void _d_sitestats_hit(SiteTable* table, Site* site, uint64_t total);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Contended path for binaries compiled with ldc's -thin-locks.
+ *
+ * A thin lock is two words, an owner and a recursion count, and is only
+ * used for a bare synchronized {}. The compiler gives it a global of its own
+ * next to the frontend's __critsec (see DtoCriticalSectionCall in
+ * gen/llvmhelpers.cpp), so _d_criticalenter never sees one. Object
+ * monitors, and with them synchronized (obj) and synchronized methods,
+ * stay on druntime's _d_monitorenter/_d_monitorexit. The owner is the address
+ * of _d_thinlock_self, which is distinct for every live thread. Taking a
+ * free lock and re-entering an owned one is done inline; the compiler only
+ * calls _d_thinlock_acquire when another thread holds the lock, and the
+ * unlock is a release store of 0 to the owner.
+ *
+ * With -thin-lock-stats every synchronized {} passes a Site descriptor and
+ * the contention seen at each site is dumped on exit, most spins first, to
+ * stderr or to the file named by the LDC_LOCKSTATS environment variable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+#include <time.h>
+
+#include "../sitestats/sitestats.h"
+
+/* Must match DtoThinLockType. */
+typedef struct ThinLock
+{
+    size_t owner;
+    size_t count;
+} ThinLock;
+
+__thread char _d_thinlock_self;
+
+static SiteTable lockSites = { "LDC_LOCKSTATS", "spins", "contended" };
+
+static void relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+/* Spin for a short while, then yield, then sleep in growing steps of at
+ * most a millisecond so a long critical section does not burn a core. */
+static void backoff(uint64_t round)
+{
+    if (round < 64)
+    {
+        relax();
+    }
+    else if (round < 128)
+    {
+        sched_yield();
+    }
+    else
+    {
+        struct timespec ts;
+        uint64_t us = round - 127;
+        ts.tv_sec = 0;
+        ts.tv_nsec = (long)(us < 1000 ? us : 1000) * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+void _d_thinlock_acquire(ThinLock* lock, size_t self, Site* site)
+{
+    uint64_t round = 0;
+
+    for (;;)
+    {
+        if (*(volatile size_t*)&lock->owner == 0 && __sync_bool_compare_and_swap(&lock->owner, 0, self))
+            break;
+        backoff(round++);
+    }
+    lock->count = 1;
+
+    if (site)
+        _d_sitestats_hit(&lockSites, site, round);
+}